@@ -0,0 +1,425 @@
+//
+// Stateful version of mcv::marker::apply_AR which keeps its buffers between frames
+//
+
+#include "ARPipeline.h"
+#include "marker.h"
+#include "utils.h"
+#include <opencv2/core/utility.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+
+// Pixels added around the previous quad to obtain the region of interest of a track
+static const int TRACKING_MARGIN = 24;
+// Half size of cornerSubPix window used to refine detected corners at full detection scale
+static const int REFINE_WINDOW = 5;
+// Window of cornerSubPix used to refine tracked corners, it limits the motion followed between two frames
+static const int TRACKING_WINDOW = 7;
+// Max distance between a boundary and its polygon approximation as a fraction of boundary length ( POLYGON corners )
+static const float POLYGON_EPSILON_RATIO = 0.02f;
+// Matches on a canvas smaller than mcv::marker::CANVAS_SIZE with score within this margin from MATCH_THRESHOLD ( on
+// both sides ) are verified at full size, resampling blurs edges so low resolution scores are less reliable near the
+// threshold
+static const float CANVAS_VERIFY_MARGIN = 0.03f;
+
+mcv::ARPipeline::Frame::Frame() {
+    // boundaries of a frame are bump allocated and released all together by the next frame
+    extractor.set_arena_allocation(true);
+}
+
+mcv::ARPipeline::ARPipeline() {}
+
+void mcv::ARPipeline::setTracking(bool tracking, int detection_interval) {
+    m_tracking = tracking;
+    m_detection_interval = std::max(0, detection_interval);
+    m_tracks.clear();
+    m_tracked_frames = 0;
+}
+
+void mcv::ARPipeline::setCornerDetector(corner_detector detector) {
+    // Checked also in release builds, Harris on a downscaled frame finds wrong corners without any error
+    if(detector != corner_detector::POLYGON && m_detection_scale != 1){
+        CV_Error(cv::Error::StsBadArg, "Harris corners need detection scale 1");
+    }
+    m_corner_detector = detector;
+}
+
+void mcv::ARPipeline::setDetectionScale(int scale) {
+    if(scale != 1 && scale != 2 && scale != 4){
+        CV_Error(cv::Error::StsOutOfRange, "Only 1, 2 and 4 detection scales are supported");
+    }
+    if(scale != 1 && m_corner_detector != corner_detector::POLYGON){
+        CV_Error(cv::Error::StsBadArg, "Detection scale 2 and 4 need POLYGON corners");
+    }
+    m_detection_scale = scale;
+}
+
+void mcv::ARPipeline::applyAR(const mcv::Matcher& matcher, cv::Mat& camera_frame, bool debug_info) {
+    m_skipped_rows = 0;
+
+    if(debug_info) {
+        camera_frame.copyTo(m_frame_debug);
+    }
+
+    // Tracked markers are searched only around their previous position, full detection runs periodically or when a
+    // marker is lost ( camera_frame is untouched in that case )
+    if(m_tracking && !m_tracks.empty() && m_tracked_frames < m_detection_interval){
+        if(trackMarkers(matcher, camera_frame)){
+            ++m_tracked_frames;
+            return;
+        }
+    }
+    m_tracked_frames = 0;
+    detectMarkers(matcher, camera_frame);
+}
+
+void mcv::ARPipeline::getDetections(std::vector<Detection>& detections) const {
+    detections.clear();
+    // Tracked frames draw the candidates of the tracks, the other ones the matched candidates of full detection
+    if(isTracking()){
+        appendDetections(m_track_candidates, (int)m_tracks.size(), detections);
+    }else {
+        appendDetections(m_frame.candidates, m_frame.candidates_number, detections);
+    }
+}
+
+void mcv::ARPipeline::getDetections(const Frame& frame, std::vector<Detection>& detections) {
+    detections.clear();
+    appendDetections(frame.candidates, frame.candidates_number, detections);
+}
+
+void mcv::ARPipeline::appendDetections(const std::vector<Candidate>& candidates, int candidates_number, std::vector<Detection>& detections) {
+    for(int i = 0; i < candidates_number; ++i){
+        const Candidate& candidate = candidates[i];
+        if(candidate.matched_image != nullptr){
+            Detection detection;
+            detection.marker_index = candidate.marker_index;
+            detection.orientation = candidate.orientation;
+            detection.corners = candidate.corners;
+            detections.push_back(detection);
+        }
+    }
+}
+
+void mcv::ARPipeline::detectMarkers(const mcv::Matcher& matcher, cv::Mat& camera_frame) {
+    thresholdFrame(camera_frame, m_frame);
+    findCorners(m_frame);
+    matchFrame(matcher, m_frame);
+    m_skipped_rows += m_frame.skipped_rows;
+
+    // Matched candidates become the tracks followed by next frames
+    m_tracks.clear();
+    if(m_tracking){
+        for(int i = 0; i < m_frame.candidates_number; ++i){
+            const Candidate& candidate = m_frame.candidates[i];
+            if(candidate.matched_image != nullptr){
+                Track track;
+                track.corners = candidate.corners;
+                track.orientation = candidate.orientation;
+                track.marker_index = candidate.marker_index;
+                m_tracks.push_back(track);
+            }
+        }
+    }
+    drawFrame(m_frame, camera_frame);
+}
+
+void mcv::ARPipeline::thresholdFrame(const cv::Mat& camera_frame, Frame& frame) const {
+    ///=== STEP 1 ===
+    // Convert original image into gray scale image
+    cv::cvtColor(camera_frame, frame.grayscale, cv::COLOR_RGB2GRAY);
+
+    ///=== STEP 2 ===
+    //Calculate threshold image from the gray scale ( written directly with the padding needed by boundary extractor )
+    frame.detection_scale = m_detection_scale;
+    if(frame.detection_scale > 1){
+        // Boundaries and corners are found on a downscaled frame, full resolution is thresholded with the same value
+        // because cornerSubPix and warps still work on it
+        cv::resize(frame.grayscale, frame.small_grayscale, cv::Size(frame.grayscale.cols/frame.detection_scale, frame.grayscale.rows/frame.detection_scale), 0, 0, cv::INTER_AREA);
+        frame.threshold = mcv::otsu_thresholding_fused(frame.small_grayscale, frame.small_th_padded, 1);
+        mcv::threshold_padded(frame.threshold, frame.grayscale, frame.frame_th_padded, 1);
+    }else {
+        frame.threshold = mcv::otsu_thresholding_fused(frame.grayscale, frame.frame_th_padded, 1);
+    }
+    frame.frame_th = frame.frame_th_padded(cv::Rect(1, 1, frame.grayscale.cols, frame.grayscale.rows));
+}
+
+void mcv::ARPipeline::findCorners(Frame& frame) const {
+    mcv::boundary_extractor& extractor = frame.extractor;
+
+    ///=== STEP 3 ===
+    // Boundary extraction
+    extractor.set_padded_image(frame.detection_scale > 1 ? frame.small_th_padded : frame.frame_th_padded);
+    ///=== STEP 4 ===
+    // Length filter is applied while tracing, boundaries too long are never stored ( limits are full resolution lengths )
+    extractor.set_length_limits(mcv::marker::BOUNDARY_MIN_LENGTH/frame.detection_scale, mcv::marker::BOUNDARY_MAX_LENGTH/frame.detection_scale);
+    extractor.set_boundary_storage(m_boundary_storage);
+    if(m_parallel_boundaries){
+        extractor.find_boundaries_parallel(mcv::BLACK);
+    }else {
+        extractor.find_boundaries(mcv::BLACK);
+    }
+
+    if(m_corner_detector == corner_detector::POLYGON){
+        ///=== STEP 5-7 ===
+        // corners are vertices of the polygon approximation of each boundary, no image is needed
+        extractor.compute_corners_polygon(POLYGON_EPSILON_RATIO);
+    }else {
+        ///=== STEP 5 ===
+        extractor.create_boundaries_image(frame.boundaries_img);// 1 pixel of padding
+
+        ///=== STEP 6-7 ===
+        //===detect corners of the boundaries with harris corner (WARNING both images have 1px of padding respect to the original one )
+        // harris response is evaluated only around survived boundaries, the only pixels read by corners search
+        int block_size = 11;
+        int kernel_size = 7;
+        float free_parameter = 0.05f; // more little more corners will be found
+        extractor.compute_corners_roi(frame.boundaries_img, block_size, kernel_size, free_parameter);
+    }
+    ///=== STEP 8 ===
+    extractor.keep_between_corners(4, 4);
+
+    ///=== STEP 9 ===
+    // Corners are refined in place into the float store of the extractor and kept with subpixel precision
+    std::vector<cv::Point2f>& corner_points = extractor.collect_corners();
+    if(frame.detection_scale > 1){
+        // Corners of the downscaled frame are lifted to full resolution ( pixel centers are scaled )
+        for(cv::Point2f& point : corner_points){
+            point.x = (point.x + 0.5f)*frame.detection_scale - 0.5f;
+            point.y = (point.y + 0.5f)*frame.detection_scale - 0.5f;
+        }
+    }
+    const cv::TermCriteria criteria = cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 100, 0.001);
+    // cornerSubPix optimization is based on original thresholded image, corners lifted from a downscaled frame carry
+    // its localisation error multiplied by the scale so the search window grows with it
+    const int window = REFINE_WINDOW + 2*(frame.detection_scale - 1);
+    if(!corner_points.empty()) {
+        cv::cornerSubPix(frame.frame_th, corner_points, cv::Size(window, window), cv::Size(-1, -1), criteria); // (-1,-1) means no zero zone
+    }
+}
+
+void mcv::ARPipeline::matchFrame(const mcv::Matcher& matcher, Frame& frame) const {
+    //========== HOMOGRAPHY =============
+    // All homography operation are applied into unblured image
+    // warp has been computed in inverse_map configuration to avoid white hole when picture where reported to original one
+    const std::vector<mcv::boundary> &boundaries = frame.extractor.get_boundaries();
+    frame.candidates_number = (int)boundaries.size();
+    if(frame.candidates.size() < boundaries.size()){
+        frame.candidates.resize(boundaries.size()); // old slots keep their buffers
+    }
+
+    // Steps 10-13 for each candidate, candidates are independent so they can be processed concurrently
+    if(m_parallel_candidates && frame.candidates_number > 1) {
+        cv::parallel_for_(cv::Range(0, frame.candidates_number), [&](const cv::Range& range){
+            for(int i = range.start; i < range.end; ++i){
+                matchCandidate(matcher, frame, boundaries[i], frame.candidates[i]);
+            }
+        });
+    }else{
+        for(int i = 0; i < frame.candidates_number; ++i){
+            matchCandidate(matcher, frame, boundaries[i], frame.candidates[i]);
+        }
+    }
+
+    frame.skipped_rows = 0;
+    for(int i = 0; i < frame.candidates_number; ++i){
+        frame.skipped_rows += frame.candidates[i].skipped_rows;
+    }
+}
+
+void mcv::ARPipeline::drawFrame(Frame& frame, cv::Mat& camera_frame) const {
+    ///=== STEP 14 ===
+    // Replacements are drawn in boundaries order so the result doesn't depend on scheduling
+    for(int i = 0; i < frame.candidates_number; ++i){
+        Candidate& candidate = frame.candidates[i];
+        if(candidate.matched_image != nullptr){
+            drawCandidate(candidate, camera_frame);
+        }
+    }
+}
+
+bool mcv::ARPipeline::trackMarkers(const mcv::Matcher& matcher, cv::Mat& camera_frame) {
+    if(m_track_candidates.size() < m_tracks.size()){
+        m_track_candidates.resize(m_tracks.size()); // old slots keep their buffers
+    }
+    // All tracks are verified before drawing, so a lost track leaves camera_frame untouched for full detection
+    for(int i = 0; i < (int)m_tracks.size(); ++i){
+        if(!trackCandidate(matcher, camera_frame, m_tracks[i], m_track_candidates[i])){
+            m_tracks.clear();
+            return false;
+        }
+    }
+    for(int i = 0; i < (int)m_tracks.size(); ++i){
+        drawCandidate(m_track_candidates[i], camera_frame);
+    }
+    return true;
+}
+
+bool mcv::ARPipeline::trackCandidate(const mcv::Matcher& matcher, const cv::Mat& camera_frame, Track& track, Candidate& candidate) {
+    // Region of interest around previous quad
+    double min_x = track.corners[0][0], max_x = min_x, min_y = track.corners[0][1], max_y = min_y;
+    for(const cv::Vec2d& corner : track.corners){
+        min_x = std::min(min_x, corner[0]);
+        max_x = std::max(max_x, corner[0]);
+        min_y = std::min(min_y, corner[1]);
+        max_y = std::max(max_y, corner[1]);
+    }
+    cv::Rect roi((int)min_x - TRACKING_MARGIN, (int)min_y - TRACKING_MARGIN,
+                 (int)(max_x - min_x) + 2*TRACKING_MARGIN + 1, (int)(max_y - min_y) + 2*TRACKING_MARGIN + 1);
+    roi &= cv::Rect(0, 0, camera_frame.cols, camera_frame.rows);
+    if(roi.width <= 2*TRACKING_WINDOW || roi.height <= 2*TRACKING_WINDOW){
+        return false; // marker is out of frame
+    }
+
+    // Gray scale and threshold only inside region of interest, with the threshold of the last full detection
+    cv::cvtColor(camera_frame(roi), m_track_grayscale, cv::COLOR_RGB2GRAY);
+    m_track_th.create(roi.height, roi.width, CV_8UC1);
+    for(int i = 0; i < roi.height; ++i){
+        mcv::threshold_row(m_frame.threshold, m_track_grayscale.ptr<uchar>(i), m_track_th.ptr<uchar>(i), roi.width);
+    }
+
+    // Refine previous corners on the new frame, corners too close to region border mean that the marker is leaving
+    m_track_points.clear();
+    for(const cv::Vec2d& corner : track.corners){
+        const float x = (float)(corner[0] - roi.x), y = (float)(corner[1] - roi.y);
+        if(x < TRACKING_WINDOW || y < TRACKING_WINDOW || x >= roi.width - TRACKING_WINDOW || y >= roi.height - TRACKING_WINDOW){
+            return false;
+        }
+        m_track_points.push_back(cv::Point2f(x, y));
+    }
+    const cv::TermCriteria criteria = cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 100, 0.001);
+    cv::cornerSubPix(m_track_th, m_track_points, cv::Size(TRACKING_WINDOW, TRACKING_WINDOW), cv::Size(-1,-1), criteria);
+
+    candidate.corners.clear();
+    for(const cv::Point2f& point : m_track_points){
+        candidate.corners.push_back(cv::Vec2d(point.x + roi.x, point.y + roi.y));
+    }
+    candidate.H = cv::findHomography(candidate.corners, mcv::marker::DST_POINTS);
+    if(candidate.H.empty()){
+        return false;
+    }
+
+    // Warp region of interest: homography of the frame is moved into region coordinates
+    const cv::Matx33d roi_to_frame(1, 0, roi.x,
+                                   0, 1, roi.y,
+                                   0, 0, 1);
+    m_track_H = candidate.H * cv::Mat(roi_to_frame);
+
+    // Corners keep their order so the orientation found by full detection is still valid, it is already known so the
+    // rotation is folded into the homography and the region is warped directly with marker orientation ( rotation is
+    // folded at full size and then scaled to the canvas of the matcher, the same as rotating on the smaller canvas )
+    candidate.orientation = track.orientation;
+    mcv::marker::rotate_homography(m_track_H, candidate.orientation, m_track_H_rotated);
+    const int canvas_size = matcher.getCanvasSize();
+    const cv::Mat* H_warp = &m_track_H_rotated;
+    if(canvas_size != mcv::marker::CANVAS_SIZE){
+        mcv::marker::canvas_homography(m_track_H_rotated, canvas_size, candidate.H_canvas);
+        H_warp = &(candidate.H_canvas);
+    }
+    cv::warpPerspective(m_track_th, candidate.rotated_img, *H_warp, cv::Size(canvas_size, canvas_size), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
+
+    // Tracking confidence is the match score of the tracked marker only
+    // ( on a smaller canvas scores just under the threshold are verified too, so they must be exact )
+    const bool low_resolution = canvas_size != mcv::marker::CANVAS_SIZE;
+    const float threshold = low_resolution ? mcv::marker::MATCH_THRESHOLD - CANVAS_VERIFY_MARGIN : mcv::marker::MATCH_THRESHOLD;
+    const float score = matcher.computeScore(track.marker_index, candidate.rotated_img, threshold);
+    if(score <= threshold){
+        return false;
+    }
+    if(low_resolution && score < mcv::marker::MATCH_THRESHOLD + CANVAS_VERIFY_MARGIN){
+        // Low resolution score is close to the threshold: region is warped at full size and compared again, as full
+        // detection does
+        cv::warpPerspective(m_track_th, candidate.verify_img, m_track_H_rotated, cv::Size(mcv::marker::CANVAS_SIZE, mcv::marker::CANVAS_SIZE), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
+        if(matcher.verifyScore(track.marker_index, candidate.verify_img, mcv::marker::MATCH_THRESHOLD) <= mcv::marker::MATCH_THRESHOLD){
+            return false;
+        }
+    }
+    candidate.marker_index = track.marker_index;
+    candidate.matched_image = &(matcher.getReplacement(track.marker_index));
+    track.corners = candidate.corners;
+    return true;
+}
+
+void mcv::ARPipeline::drawCandidate(Candidate& candidate, cv::Mat& camera_frame) const {
+    // Picture rotation is folded into the homography so the replacement is warped only once into the frame
+    mcv::marker::rotate_homography(candidate.H, candidate.orientation, candidate.H_rotated);
+    // Replacement is stretched over the marker whatever its size: canvas coordinates are scaled to replacement ones
+    const cv::Mat& replacement = *(candidate.matched_image);
+    if(replacement.cols != mcv::marker::CANVAS_SIZE || replacement.rows != mcv::marker::CANVAS_SIZE){
+        const double scale_x = (double)replacement.cols/mcv::marker::CANVAS_SIZE;
+        const double scale_y = (double)replacement.rows/mcv::marker::CANVAS_SIZE;
+        double* r0 = candidate.H_rotated.ptr<double>(0);
+        double* r1 = candidate.H_rotated.ptr<double>(1);
+        for(int i = 0; i < 3; ++i){
+            r0[i] *= scale_x;
+            r1[i] *= scale_y;
+        }
+    }
+    cv::warpPerspective(replacement, camera_frame, candidate.H_rotated, cv::Size(camera_frame.cols, camera_frame.rows), cv::WARP_INVERSE_MAP, cv::BORDER_TRANSPARENT);
+}
+
+void mcv::ARPipeline::matchCandidate(const mcv::Matcher& matcher, const Frame& frame, const mcv::boundary& boundary, Candidate& candidate) const {
+    ///=== STEP 10 ===
+    // find Homography
+    candidate.corners.clear();
+    const std::vector<cv::Point2f>& corner_points = frame.extractor.get_corner_points();
+    for (int i = boundary.first_corner; i < boundary.first_corner + boundary.corners_number; ++i) {
+        candidate.corners.push_back(cv::Vec2d(corner_points[i].x, corner_points[i].y));
+    }
+    candidate.H = cv::findHomography(candidate.corners, mcv::marker::DST_POINTS);
+    candidate.skipped_rows = 0;
+    if(candidate.H.empty()){
+        // degenerate corners, nothing to warp
+        candidate.marker_index = -1;
+        candidate.matched_image = nullptr;
+        return;
+    }
+    // Candidate is warped directly into the canvas of the matcher, H is kept at full size to draw the replacement
+    const int canvas_size = matcher.getCanvasSize();
+    const cv::Mat* H_warp = &(candidate.H);
+    if(canvas_size != mcv::marker::CANVAS_SIZE){
+        mcv::marker::canvas_homography(candidate.H, canvas_size, candidate.H_canvas);
+        H_warp = &(candidate.H_canvas);
+    }
+    // Use bilinear interpolation here to obtain better warping where compute matching
+    cv::warpPerspective(frame.frame_th, candidate.warped_img, *H_warp, cv::Size(canvas_size, canvas_size), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
+    ///=== STEP 11 ===
+    // Detect orientation, with a min confidence candidates with ambiguous orientation aren't matched at all
+    float orientation_confidence = 0.0f;
+    candidate.orientation = mcv::marker::detect_orientation(candidate.warped_img,
+                                                            m_orientation_min_confidence > 0.0f ? &orientation_confidence : nullptr);
+    if(m_orientation_min_confidence > 0.0f && orientation_confidence < m_orientation_min_confidence){
+        candidate.marker_index = -1;
+        candidate.matched_image = nullptr;
+        return;
+    }
+
+    ///=== STEP 12 ===
+    // Rotation by 90 degree steps only moves pixels, no second warp is needed ( nothing to do for 0 degree )
+    const cv::Mat* to_match = &(candidate.warped_img);
+    if(candidate.orientation != 0){
+        mcv::marker::rotate_canvas(candidate.warped_img, candidate.rotated_img, candidate.orientation);
+        to_match = &(candidate.rotated_img);
+    }
+
+    ///=== STEP 13 ===
+    // ============ MATCHING
+    // On a smaller canvas the best marker is searched down to the lower side of the verification band, so a marker
+    // which scores just under the threshold at low resolution is verified at full size instead of being lost
+    float score = 0.0f;
+    const bool low_resolution = canvas_size != mcv::marker::CANVAS_SIZE;
+    const float threshold = low_resolution ? mcv::marker::MATCH_THRESHOLD - CANVAS_VERIFY_MARGIN : mcv::marker::MATCH_THRESHOLD;
+    candidate.marker_index = matcher.findBestMatchIndex(*to_match, threshold, &(candidate.skipped_rows), &score,
+                                                        &(candidate.score_buffers));
+    if(candidate.marker_index > -1 && low_resolution && score < mcv::marker::MATCH_THRESHOLD + CANVAS_VERIFY_MARGIN){
+        // Low resolution score is close to the threshold: candidate is warped at full size with marker orientation
+        // and compared again with the matched marker only
+        mcv::marker::rotate_homography(candidate.H, candidate.orientation, candidate.H_rotated);
+        cv::warpPerspective(frame.frame_th, candidate.verify_img, candidate.H_rotated, cv::Size(mcv::marker::CANVAS_SIZE, mcv::marker::CANVAS_SIZE), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
+        if(matcher.verifyScore(candidate.marker_index, candidate.verify_img, mcv::marker::MATCH_THRESHOLD) <= mcv::marker::MATCH_THRESHOLD){
+            candidate.marker_index = -1;
+        }
+    }
+    candidate.matched_image = candidate.marker_index > -1 ? &(matcher.getReplacement(candidate.marker_index)) : nullptr;
+}
@@ -0,0 +1,298 @@
+//
+// Stateful version of mcv::marker::apply_AR which keeps its buffers between frames
+//
+
+#ifndef PICTUREAR_ARPIPELINE_H
+#define PICTUREAR_ARPIPELINE_H
+
+
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include "boundary_extractor.h"
+#include "Matcher.h"
+
+namespace mcv{
+    /**
+     * This class executes the same pipeline of mcv::marker::apply_AR ( see its documentation for the steps ) but
+     * intermediate images, warped candidates and boundaries ( from the extractor arenas ) are owned by the pipeline and
+     * reused while the frame size doesn't change. Some small allocations are still done for each frame: the homography
+     * returned by cv::findHomography for each candidate and the corner
+     * vectors of tracks ( score vectors of the matcher are kept in the candidate slots ).
+     * One instance must be used by one thread at time.
+     */
+    class ARPipeline {
+    private:
+        /**
+         * Result and scratch buffers of the homography, warp and match stage of a single candidate, slots are kept
+         * between frames to reuse their buffers
+         */
+        struct Candidate {
+            std::vector<cv::Vec2d> corners; // corners of the candidate
+            cv::Mat H; // homography between candidate corners and mcv::marker::DST_POINTS
+            cv::Mat H_canvas; // H scaled to the canvas of the matcher ( not used for a full size canvas, while
+                               // tracking it is m_track_H_rotated scaled )
+            cv::Mat warped_img; // candidate warped into the canvas of the matcher
+            cv::Mat rotated_img; // warped_img with marker orientation ( not used for 0 degree )
+            cv::Mat H_rotated; // H followed by marker rotation, it maps the replacement into the frame
+            cv::Mat verify_img; // candidate warped at full size with marker orientation to verify a low resolution match
+            int orientation = 0;
+            const cv::Mat* matched_image = nullptr; // replacement of the matched marker, nullptr if no match
+            int marker_index = -1; // index of the matched marker, -1 if no match
+            int skipped_rows = 0;
+            mcv::Matcher::ScoreBuffers score_buffers; // scores of mcv::Matcher::findBestMatchIndex for this slot
+        };
+
+        /**
+         * Marker matched in a previous frame which is followed without a full detection
+         */
+        struct Track {
+            std::vector<cv::Vec2d> corners; // corners in the last frame, same order of the detected boundary
+            int orientation = 0;
+            int marker_index = -1;
+        };
+
+    public:
+        /**
+         * Intermediate images, boundaries and candidates of the full detection of a single frame, the pipeline keeps
+         * one for its frames and mcv::FrameExecutor keeps one for each frame in flight
+         */
+        struct Frame {
+            cv::Mat grayscale;
+            cv::Mat frame_th_padded; // thresholded frame with 1px of padding used by boundary extractor
+            cv::Mat frame_th; // view of frame_th_padded without padding
+            cv::Mat small_grayscale; // downscaled grayscale frame ( only with detection scale > 1 )
+            cv::Mat small_th_padded; // thresholded downscaled frame with 1px of padding
+            cv::Mat boundaries_img; // 1px larger than the detection frame
+            int detection_scale = 1; // detection scale used by thresholdFrame
+            int threshold = 0; // Otsu threshold
+            mcv::boundary_extractor extractor;
+            std::vector<Candidate> candidates; // one slot for each boundary survived to filtering
+            int candidates_number = 0; // slots used by the last frame
+            int skipped_rows = 0; // rows not compared by bounded matching
+
+            Frame();
+        };
+
+        /**
+         * Marker found into the last frame
+         */
+        struct Detection {
+            int marker_index = -1;
+            int orientation = 0; // orientation found by mcv::marker::detect_orientation
+            std::vector<cv::Vec2d> corners; // corners into the frame, same order of the detected boundary
+        };
+
+    private:
+        cv::Mat m_frame_debug;
+        Frame m_frame; // buffers of full detection, reused between frames
+        int m_detection_scale = 1; // downscale factor of the frame where boundaries and corners are found
+        int m_skipped_rows = 0; // rows not compared by bounded matching in the last frame
+        bool m_parallel_candidates = true;
+        corner_detector m_corner_detector = corner_detector::HARRIS;
+        bool m_parallel_boundaries = false;
+        float m_orientation_min_confidence = 0.0f; // 0 means that no candidate is rejected by its orientation
+        boundary_storage m_boundary_storage = boundary_storage::POINTS;
+
+        // Tracking state
+        bool m_tracking = false;
+        int m_detection_interval = 10; // max number of tracked frames between two full detections
+        int m_tracked_frames = 0; // frames tracked since last full detection
+        std::vector<Track> m_tracks; // markers matched by the last full detection ( its threshold is reused )
+        std::vector<Candidate> m_track_candidates; // one slot for each track
+        std::vector<cv::Point2f> m_track_points;
+        cv::Mat m_track_grayscale; // region of interest of the current track
+        cv::Mat m_track_th;
+        cv::Mat m_track_H; // homography from region of interest to mcv::marker::DST_POINTS
+        cv::Mat m_track_H_rotated; // m_track_H followed by marker rotation
+
+        /**
+         * Homography, warp, orientation detection and matching of a single candidate ( steps 10-13 of apply_AR ),
+         * candidates are warped and matched on the canvas of the matcher ( see mcv::Matcher::setCanvasSize ), a match
+         * on a smaller canvas whose score is close to the threshold is verified again at full size.
+         * It only writes into "candidate" so different candidates can be processed concurrently
+         * @param matcher: markers and their replacements
+         * @param frame: frame of the candidate
+         * @param boundary: boundary of the candidate, its 4 refined corners are read from the extractor corner store
+         * @param candidate: slot where results are stored
+         */
+        void matchCandidate(const mcv::Matcher& matcher, const Frame& frame, const mcv::boundary& boundary, Candidate& candidate) const;
+
+        /**
+         * Full detection, steps 1-14 of apply_AR, matched markers become the new tracks
+         */
+        void detectMarkers(const mcv::Matcher& matcher, cv::Mat& camera_frame);
+
+        /**
+         * Follow all tracks into "camera_frame" and draw their replacements, nothing is drawn if a track is lost
+         * @return true if all tracks have been found again
+         */
+        bool trackMarkers(const mcv::Matcher& matcher, cv::Mat& camera_frame);
+
+        /**
+         * Refine corners of "track" in a region of interest around its previous position and verify that the marker
+         * is still there
+         * @param track: track to follow, its corners are updated only if it is found
+         * @param candidate: slot where homography, warp and match are stored
+         * @return true if the marker is still matched
+         */
+        bool trackCandidate(const mcv::Matcher& matcher, const cv::Mat& camera_frame, Track& track, Candidate& candidate);
+
+        /**
+         * Draw replacement of a matched candidate into "camera_frame" ( step 14 of apply_AR ), the replacement is
+         * stretched over the marker quad whatever its size
+         */
+        void drawCandidate(Candidate& candidate, cv::Mat& camera_frame) const;
+
+        /**
+         * Append a detection for each matched candidate among the first "candidates_number" ones
+         */
+        static void appendDetections(const std::vector<Candidate>& candidates, int candidates_number, std::vector<Detection>& detections);
+
+    public:
+        ARPipeline();
+
+        /*
+         * Stages of the full detection, they only write into "frame" so different frames can be processed
+         * concurrently by different threads ( see mcv::FrameExecutor ), the pipeline must not be configured meanwhile
+         */
+
+        /**
+         * Convert "camera_frame" to gray scale and threshold it ( steps 1-2 of apply_AR )
+         */
+        void thresholdFrame(const cv::Mat& camera_frame, Frame& frame) const;
+
+        /**
+         * Extract boundaries, find their corners and refine them ( steps 3-9 of apply_AR )
+         */
+        void findCorners(Frame& frame) const;
+
+        /**
+         * Homography, warp, orientation detection and matching of all candidates ( steps 10-13 of apply_AR )
+         * @param matcher: markers and their replacements
+         */
+        void matchFrame(const mcv::Matcher& matcher, Frame& frame) const;
+
+        /**
+         * Draw replacements of matched candidates into "camera_frame" ( step 14 of apply_AR )
+         */
+        void drawFrame(Frame& frame, cv::Mat& camera_frame) const;
+
+        /**
+         * Apply AR to "camera_frame" as mcv::marker::apply_AR does
+         * @param matcher: markers and their replacements
+         * @param camera_frame: original image on which AR will be applied
+         * @param debug_info: if true additional images will be shown with debug pourpose
+         */
+        void applyAR(const mcv::Matcher& matcher, cv::Mat& camera_frame, bool debug_info);
+
+        /**
+         * Enable or disable parallel processing of candidates ( enabled by default ): homography, warp and matching of
+         * each candidate run concurrently and then replacements are drawn in the same order of the serial pipeline
+         * @param parallel: true to process candidates concurrently
+         */
+        inline void setParallelCandidates(bool parallel){
+            m_parallel_candidates = parallel;
+        }
+
+        /**
+         * Select how corners of the boundaries are found ( HARRIS by default ), POLYGON works only on boundary points so
+         * boundaries image and harris response are not computed at all. HARRIS needs detection scale 1
+         * ( see setDetectionScale )
+         * @param detector: corner detection strategy
+         * @throws cv::Exception if detector is HARRIS and detection scale is not 1, the detector isn't changed
+         */
+        void setCornerDetector(corner_detector detector);
+
+        /**
+         * Select the min confidence of mcv::marker::detect_orientation to compare a candidate with markers ( 0 by
+         * default, so no candidate is rejected ), candidates with an ambiguous orientation are discarded before
+         * matching. mcv::marker::ORIENTATION_MIN_CONFIDENCE is a suggested value, measure the detections lost with
+         * picturear-batch --orientation-confidence before enabling it
+         * @param confidence: min margin between best and second best orientation rectangle ( see detect_orientation )
+         */
+        inline void setOrientationMinConfidence(float confidence){
+            m_orientation_min_confidence = confidence;
+        }
+
+        /**
+         * Enable or disable parallel boundary extraction ( disabled by default ): boundaries which start into different
+         * bands of rows are traced concurrently ( see mcv::boundary_extractor::find_boundaries_parallel ), boundaries
+         * found are the same
+         * @param parallel: true to trace boundaries concurrently
+         */
+        inline void setParallelBoundaries(bool parallel){
+            m_parallel_boundaries = parallel;
+        }
+
+        /**
+         * Select how points of traced boundaries are stored ( POINTS by default ), CHAIN_CODE needs less memory and
+         * decodes points while corners are found
+         * @param storage: storage of boundary points
+         */
+        inline void setBoundaryStorage(boundary_storage storage){
+            m_boundary_storage = storage;
+        }
+
+        /**
+         * Select the scale of the frame where boundaries and corners are found ( 1 by default ): with scale 2 or 4 the
+         * gray scale frame is downscaled and the Otsu threshold, boundary tracing and corner detection run on the
+         * downscaled frame with boundary length limits divided by scale, so only these steps cost about 1/scale^2.
+         * Gray scale conversion, the full resolution threshold, cornerSubPix refinement of the lifted corners, warps
+         * and matching still run at full resolution. Scale 2 and 4 need corner_detector::POLYGON ( set it first ):
+         * Harris block and kernel sizes don't fit the small boundaries of a downscaled frame.
+         * Detection quality at scale 2 and 4 can be compared with scale 1 by picturear-batch --measure-scale, measure
+         * it on real footage before enabling them
+         * @param scale: downscale factor ( 1, 2 or 4 )
+         * @throws cv::Exception if scale is not 1, 2 or 4, or if it is over 1 without POLYGON corners, the scale isn't
+         * changed
+         */
+        void setDetectionScale(int scale);
+
+        /**
+         * Enable or disable tracking ( disabled by default ): markers matched by a full detection are followed in the
+         * next frames refining their corners with cornerSubPix in a small region around the previous position, the
+         * full detection runs again after "detection_interval" tracked frames or as soon as a marker isn't matched
+         * anymore. New markers which appear while tracking are found only by the next full detection.
+         * @param tracking: true to enable tracking
+         * @param detection_interval: max number of tracked frames between two full detections
+         */
+        void setTracking(bool tracking, int detection_interval = 10);
+
+        /**
+         * @return true if last frame has been processed by tracking instead of full detection
+         */
+        inline bool isTracking() const {
+            return m_tracked_frames > 0;
+        }
+
+        /**
+         * Markers drawn into the last frame processed by applyAR, either by full detection or by tracking
+         * @param detections: output, one detection for each marker drawn in drawing order
+         */
+        void getDetections(std::vector<Detection>& detections) const;
+
+        /**
+         * Markers drawn into "frame" by drawFrame ( e.g. a frame of mcv::FrameExecutor )
+         * @param detections: output, one detection for each marker drawn in drawing order
+         */
+        static void getDetections(const Frame& frame, std::vector<Detection>& detections);
+
+        /**
+         * @return bytes of boundary storage allocated from the extractor arenas during the last full detection
+         */
+        inline size_t getArenaBytesUsed() const {
+            return m_frame.extractor.get_arena_bytes_used();
+        }
+
+        /**
+         * @return number of marker rows that bounded matching didn't compare during the last frame
+         * ( see mcv::Matcher::setBoundedScoring )
+         */
+        inline int getSkippedRows() const {
+            return m_skipped_rows;
+        }
+    };
+}
+
+
+#endif //PICTUREAR_ARPIPELINE_H
@@ -0,0 +1,153 @@
+//
+// Pipelined execution of mcv::ARPipeline stages over a sequence of frames
+//
+
+#include "FrameExecutor.h"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <chrono>
+
+/**
+ * Wait a little before polling a queue again: yield first, then sleep so idle stages don't keep a core busy
+ */
+static void backoff(int& spins){
+    if(++spins < 64){
+        std::this_thread::yield();
+    }else{
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+mcv::FrameExecutor::FrameExecutor(const mcv::ARPipeline& pipeline, const mcv::Matcher& matcher, int depth):
+        m_pipeline(pipeline), m_matcher(matcher),
+        // Frames in flight are at most those into the queues plus one processed by each stage, plus the new frame of
+        // submit while it waits for the first queue
+        m_free_slots((size_t)(STAGES+1)*std::max(1, depth) + STAGES + 1),
+        m_running(true), m_dropped(0) {
+    depth = std::max(1, depth);
+    for(int s = 0; s <= STAGES; ++s){
+        m_queues.push_back(std::unique_ptr<bounded_queue<Slot*>>(new bounded_queue<Slot*>((size_t)depth)));
+    }
+    for(int s = 0; s < STAGES; ++s){
+        m_threads.push_back(std::thread(&FrameExecutor::runStage, this, s));
+    }
+}
+
+mcv::FrameExecutor::~FrameExecutor() {
+    m_running.store(false);
+    for(std::thread& thread : m_threads){
+        thread.join();
+    }
+}
+
+long mcv::FrameExecutor::submit(const cv::Mat& camera_frame) {
+    Slot* slot = nullptr;
+    if(!m_free_slots.pop(slot)){
+        if(m_slots.size() < m_free_slots.capacity()){
+            m_slots.push_back(std::unique_ptr<Slot>(new Slot()));
+            slot = m_slots.back().get();
+        }else if(m_queues[0]->pop(slot)){
+            // All slots are in flight ( e.g. composited frames aren't retrieved ): the oldest frame waiting for the
+            // first stage gives its slot to the new one
+            m_dropped.fetch_add(1);
+        }else{
+            // No frame can be replaced, the new frame is dropped so slots never exceed the capacity of the free list
+            m_dropped.fetch_add(1);
+            return m_submitted++;
+        }
+    }
+    camera_frame.copyTo(slot->camera_frame); // buffer reused if possible
+    slot->index = m_submitted;
+    slot->failed = false;
+    if(!m_queues[0]->push(slot)){
+        // Drop oldest: the first queue is full so its oldest frame is replaced by the new one, if the first stage
+        // takes it meanwhile the queue has room anyway
+        Slot* oldest = nullptr;
+        if(m_queues[0]->pop(oldest)){
+            m_dropped.fetch_add(1);
+            // never full: slots are at most its capacity and this one has just left the queues
+            m_free_slots.push(oldest);
+        }
+        // only this thread pushes into the first queue and an item has been taken since the failed push, so this
+        // can't fail, the slot goes back to the free list anyway so it is never lost
+        if(!m_queues[0]->push(slot)){
+            m_dropped.fetch_add(1);
+            m_free_slots.push(slot);
+        }
+    }
+    return m_submitted++;
+}
+
+bool mcv::FrameExecutor::retrieve(cv::Mat& composited, long* frame_index, std::vector<mcv::ARPipeline::Detection>* detections) {
+    Slot* slot = nullptr;
+    if(!m_queues[STAGES]->pop(slot)){
+        return false;
+    }
+    // Buffers are exchanged, the slot keeps the old buffer of the caller for the next frame
+    std::swap(composited, slot->camera_frame);
+    if(frame_index != nullptr){
+        *frame_index = slot->index;
+    }
+    if(detections != nullptr){
+        mcv::ARPipeline::getDetections(slot->frame, *detections);
+    }
+    ++m_retrieved;
+    m_free_slots.push(slot);
+    return true;
+}
+
+void mcv::FrameExecutor::runStage(int stage) {
+    bounded_queue<Slot*>& input = *(m_queues[stage]);
+    bounded_queue<Slot*>& output = *(m_queues[stage+1]);
+    Slot* slot = nullptr;
+    int spins = 0;
+    while(m_running.load(std::memory_order_relaxed)){
+        if(!input.pop(slot)){
+            backoff(spins);
+            continue;
+        }
+        spins = 0;
+        processSlot(stage, *slot);
+        // Back pressure: the frame waits here until the next stage has room
+        while(!output.push(slot)){
+            if(!m_running.load(std::memory_order_relaxed))return;
+            backoff(spins);
+        }
+        spins = 0;
+    }
+}
+
+void mcv::FrameExecutor::processSlot(int stage, Slot& slot) const {
+    if(slot.failed){
+        return;
+    }
+    // No exception must leave the stage thread ( std::terminate ), whatever its type ( e.g. std::bad_alloc ), the
+    // frame still goes downstream so frames are retrieved in submission order and the executor drains
+    try {
+        switch((executor_stage)stage){
+            case executor_stage::THRESHOLD:
+                m_pipeline.thresholdFrame(slot.camera_frame, slot.frame);
+                break;
+            case executor_stage::CORNERS:
+                m_pipeline.findCorners(slot.frame);
+                break;
+            case executor_stage::MATCH:
+                m_pipeline.matchFrame(m_matcher, slot.frame);
+                break;
+            case executor_stage::COMPOSITE:
+                m_pipeline.drawFrame(slot.frame, slot.camera_frame);
+                break;
+        }
+    } catch (...) {
+        slot.failed = true;
+        slot.frame.candidates_number = 0;
+    }
+}
+
+int mcv::FrameExecutor::getQueueOccupancy(executor_stage stage) const {
+    return (int)m_queues[(int)stage]->size();
+}
+
+int mcv::FrameExecutor::getOutputOccupancy() const {
+    return (int)m_queues[STAGES]->size();
+}
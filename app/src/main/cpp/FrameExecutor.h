@@ -0,0 +1,139 @@
+//
+// Pipelined execution of mcv::ARPipeline stages over a sequence of frames
+//
+
+#ifndef PICTUREAR_FRAMEEXECUTOR_H
+#define PICTUREAR_FRAMEEXECUTOR_H
+
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+#include "ARPipeline.h"
+#include "Matcher.h"
+#include "bounded_queue.h"
+
+namespace mcv{
+
+    /**
+     * Stages of the full detection executed by different threads
+     */
+    enum class executor_stage{
+        THRESHOLD, // gray scale and threshold ( steps 1-2 of apply_AR )
+        CORNERS, // boundaries and corners ( steps 3-9 of apply_AR )
+        MATCH, // homography and matching ( steps 10-13 of apply_AR )
+        COMPOSITE // replacements drawn into the frame ( step 14 of apply_AR )
+    };
+
+    /**
+     * This class runs each stage of mcv::ARPipeline full detection on its own thread, stages are connected by bounded
+     * lock-free queues so successive frames are processed at the same time by different stages and throughput
+     * approaches the one of the slowest stage instead of the sum of all stages ( each frame still has the latency of
+     * the whole pipeline ).
+     * Every frame runs a full detection, tracking of the pipeline is not used because it needs the previous frame.
+     * When the first queue is full the oldest waiting frame is dropped, the next queues apply back pressure.
+     * A stage which throws ( any exception ) marks the frame as failed and it is retrieved without replacements.
+     * submit and retrieve must be called by the same thread.
+     */
+    class FrameExecutor {
+    private:
+        static const int STAGES = 4;
+
+        /**
+         * A frame in flight: the frame to composite and the buffers of its detection
+         */
+        struct Slot {
+            cv::Mat camera_frame;
+            mcv::ARPipeline::Frame frame;
+            long index = 0; // submission order
+            bool failed = false; // a stage threw, the next stages skip the frame
+        };
+
+        const mcv::ARPipeline& m_pipeline;
+        const mcv::Matcher& m_matcher;
+        std::vector<std::unique_ptr<Slot>> m_slots; // all slots, created when needed
+        // m_queues[s] holds frames waiting for stage s, m_queues[STAGES] holds composited frames to retrieve
+        std::vector<std::unique_ptr<bounded_queue<Slot*>>> m_queues;
+        bounded_queue<Slot*> m_free_slots; // slots not in flight
+        std::vector<std::thread> m_threads;
+        std::atomic<bool> m_running;
+        long m_submitted = 0;
+        long m_retrieved = 0;
+        std::atomic<long> m_dropped;
+
+        /**
+         * Loop of the thread which executes "stage" until the executor is destroyed
+         */
+        void runStage(int stage);
+
+        /**
+         * Execute "stage" on a single frame, a frame whose stage throws keeps no candidates and it is retrieved
+         * without replacements
+         */
+        void processSlot(int stage, Slot& slot) const;
+
+    public:
+        /**
+         * Start one thread for each stage, pipeline and matcher must not change while the executor is alive
+         * @param pipeline: pipeline whose stages are executed ( see mcv::ARPipeline::thresholdFrame )
+         * @param matcher: markers and their replacements
+         * @param depth: capacity of each queue between two stages ( at least 1 )
+         */
+        FrameExecutor(const mcv::ARPipeline& pipeline, const mcv::Matcher& matcher, int depth = 2);
+
+        FrameExecutor(const FrameExecutor&) = delete;
+        FrameExecutor& operator=(const FrameExecutor&) = delete;
+
+        /**
+         * Stop all threads, frames still in flight are discarded
+         */
+        ~FrameExecutor();
+
+        /**
+         * Copy "camera_frame" into the executor and queue it for processing, if the first queue is full its oldest
+         * frame is dropped. Frames in flight are bounded: when all slots are in flight ( composited frames not
+         * retrieved ) the oldest frame of the first queue is dropped, or the new frame itself if that queue is empty
+         * @return index of the submitted frame ( submission order starting from 0, also for a dropped frame )
+         */
+        long submit(const cv::Mat& camera_frame);
+
+        /**
+         * Take the next composited frame if there is one ( frames are retrieved in submission order, dropped frames
+         * are missing ). Buffer of "composited" is given to the executor and reused for next frames
+         * @param composited: output, frame with replacements drawn
+         * @param frame_index: if not null index returned by submit for this frame
+         * @param detections: if not null markers drawn into the frame ( see mcv::ARPipeline::getDetections )
+         * @return false if no frame is ready
+         */
+        bool retrieve(cv::Mat& composited, long* frame_index = nullptr, std::vector<mcv::ARPipeline::Detection>* detections = nullptr);
+
+        /**
+         * @return number of frames submitted and not retrieved or dropped yet
+         */
+        inline long getFramesInFlight() const {
+            return m_submitted - m_retrieved - m_dropped.load();
+        }
+
+        /**
+         * @return number of frames dropped because the first queue was full or all slots were in flight
+         */
+        inline long getDroppedFrames() const {
+            return m_dropped.load();
+        }
+
+        /**
+         * @return number of frames waiting for "stage"
+         */
+        int getQueueOccupancy(executor_stage stage) const;
+
+        /**
+         * @return number of composited frames waiting to be retrieved
+         */
+        int getOutputOccupancy() const;
+    };
+}
+
+
+#endif //PICTUREAR_FRAMEEXECUTOR_H
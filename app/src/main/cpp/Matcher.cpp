@@ -4,6 +4,11 @@
 
 #include "Matcher.h"
 #include "marker.h"
+#include <opencv2/imgproc.hpp>
+#include <assert.h>
+#include <algorithm>
+#include <bitset>
+#include <utility>
 
 int maxIndex(const std::vector<float>& scores){
     int max_index = -1;
@@ -19,22 +24,381 @@ int maxIndex(const std::vector<float>& scores){
 
 
 
+/**
+ * Resample a square marker to "size" x "size", marker already of that size is soft copied
+ */
+static void resample_square(const cv::Mat& marker, int size, cv::Mat& resampled){
+    if(marker.rows == size && marker.cols == size){
+        resampled = marker;
+    }else{
+        const int interpolation = marker.cols > size ? cv::INTER_AREA : cv::INTER_LINEAR;
+        cv::resize(marker, resampled, cv::Size(size, size), 0, 0, interpolation);
+    }
+}
+
+// Libraries up to this number of markers compare all signatures, probing the index costs more than that
+static const int COARSE_INDEX_MIN_MARKERS = 512;
+
+static_assert(mcv::marker::SIGNATURE_WORDS*4 == 16, "Signature index needs 16 chunks of 16 bits");
+
+/**
+ * Chunk "chunk" ( 16 bits ) of a signature
+ */
+static inline uint16_t signature_chunk(const uint64_t* signature, int chunk){
+    return (uint16_t)(signature[chunk/4] >> (16*(chunk%4)));
+}
+
+/**
+ * Number of different bits between two signatures
+ */
+static inline int signature_distance(const uint64_t* a, const uint64_t* b){
+    int distance = 0;
+    for(int w = 0; w < mcv::marker::SIGNATURE_WORDS; ++w){
+        distance += (int)std::bitset<64>(a[w] ^ b[w]).count();
+    }
+    return distance;
+}
+
+/**
+ * Masks XORed with a chunk to probe the chunk values with up to a given number of different bits
+ */
+struct ChunkProbes {
+    std::vector<uint16_t> masks; // ordered by number of bits set
+    std::vector<int> level_end; // level_end[r] is the end of the masks with r bits set
+};
+
+/**
+ * Masks of the 16 bit values with up to "radius" bits set
+ */
+static ChunkProbes chunk_probes(int radius){
+    ChunkProbes probes;
+    for(int bits = 0; bits <= radius; ++bits){
+        for(int value = 0; value < 65536; ++value){
+            if((int)std::bitset<16>((unsigned long long)value).count() == bits){
+                probes.masks.push_back((uint16_t)value);
+            }
+        }
+        probes.level_end.push_back((int)probes.masks.size());
+    }
+    return probes;
+}
+
+/**
+ * @return true if "marker" can be registered: a square single channel image
+ */
+static bool is_valid_marker(const cv::Mat& marker){
+    return !marker.empty() && marker.channels() == 1 && marker.rows == marker.cols;
+}
+
+mcv::Matcher::Matcher():m_canvas_size(mcv::marker::CANVAS_SIZE) {}
+
 mcv::Matcher::Matcher(const std::vector<const cv::Mat*>& markers,
-                      const std::vector<const cv::Mat*>& replacements)
-:m_markers{markers},
- m_replacements{replacements}
-{}
+                      const std::vector<const cv::Mat*>& replacements):m_canvas_size(mcv::marker::CANVAS_SIZE)
+{
+    assert(markers.size() == replacements.size() && "Each marker must have a replacement");
+    // Soft copies, data is shared with the caller
+    for(int i = 0; i < (int)markers.size(); ++i){
+        assert(is_valid_marker(*(markers[i])) && "Markers must be square single channel images");
+        cv::Mat full_marker;
+        resample_square(*(markers[i]), mcv::marker::CANVAS_SIZE, full_marker);
+        m_full_markers.push_back(full_marker);
+        m_replacements.push_back(*(replacements[i]));
+        resampleMarker(i);
+    }
+}
 
-const cv::Mat* mcv::Matcher::findBestMatch(const cv::Mat& frame_to_match, const float threshold) const {
-    std::vector<float> scores(m_markers.size());
-    for(int i=0; i < scores.size(); ++i){
-        scores[i] = mcv::marker::compute_matching(*(m_markers[i]), frame_to_match);
+int mcv::Matcher::addMarker(const cv::Mat& marker, const cv::Mat& replacement) {
+    if(!is_valid_marker(marker)){
+        return -1;
+    }
+    // Full size copy has the size of the canvas where candidates are verified
+    cv::Mat full_marker;
+    resample_square(marker, mcv::marker::CANVAS_SIZE, full_marker);
+    m_full_markers.push_back(full_marker.data == marker.data ? marker.clone() : full_marker);
+    m_replacements.push_back(replacement.clone());
+    resampleMarker((int)m_full_markers.size()-1);
+    if(m_mode == match_mode::BIT_PACKED){
+        packMarker((int)m_markers.size()-1);
     }
+    if(m_coarse_candidates > 0){
+        indexMarker((int)m_markers.size()-1);
+    }
+    return (int)m_markers.size()-1;
+}
 
-    int max_index = maxIndex(scores);
-    if(max_index > -1 && scores[max_index] > threshold){
-        return m_replacements[max_index];
-    }else{
+void mcv::Matcher::resampleMarker(int index) {
+    m_markers.resize(m_full_markers.size());
+    if(m_canvas_size == mcv::marker::CANVAS_SIZE){
+        m_markers[index] = m_full_markers[index];
+        return;
+    }
+    // Marker is warped into the canvas with the same scale and interpolation used for candidates
+    // ( see mcv::marker::canvas_homography ), so both are sampled at the same points
+    cv::Mat H_canvas;
+    mcv::marker::canvas_homography(cv::Mat::eye(3, 3, CV_64F), m_canvas_size, H_canvas);
+    cv::warpPerspective(m_full_markers[index], m_markers[index], H_canvas, cv::Size(m_canvas_size, m_canvas_size), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
+}
+
+void mcv::Matcher::setCanvasSize(int canvas_size) {
+    assert(canvas_size >= mcv::marker::SIGNATURE_SIZE && "Canvas too small for signature");
+    m_canvas_size = canvas_size;
+    for(int i = 0; i < (int)m_full_markers.size(); ++i){
+        resampleMarker(i);
+    }
+    // Packed markers and signatures depend on the canvas
+    m_packed_words = 0;
+    setMode(m_mode);
+    setCoarseCandidates(m_coarse_candidates);
+}
+
+void mcv::Matcher::setMode(match_mode mode) {
+    m_mode = mode;
+    m_packed_markers.clear();
+    if(m_mode == match_mode::BIT_PACKED){
+        // Markers are packed only once here, candidates are packed for each match
+        for(int i = 0; i < (int)m_markers.size(); ++i){
+            packMarker(i);
+        }
+    }
+}
+
+void mcv::Matcher::packMarker(int index) {
+    const cv::Mat& marker = m_markers[index];
+    const int words = mcv::marker::packed_words(marker.rows, marker.cols);
+    assert((m_packed_words == 0 || m_packed_words == words) && "All markers must have the same size");
+    m_packed_words = words;
+    m_packed_markers.resize((size_t)(index+1)*words);
+    mcv::marker::pack_bits(marker, &(m_packed_markers[(size_t)index*words]));
+}
+
+void mcv::Matcher::setCoarseCandidates(int candidates) {
+    m_coarse_candidates = std::max(0, candidates);
+    m_signatures.clear();
+    m_chunk_bitmaps.clear();
+    for(std::vector<std::pair<uint16_t, int>>& entries : m_chunk_entries){
+        entries.clear();
+    }
+    if(m_coarse_candidates > 0){
+        // Signatures are computed and indexed only once here, candidates signature is computed for each match
+        m_chunk_bitmaps.assign((size_t)SIGNATURE_CHUNKS*65536/64, 0);
+        m_signatures.resize(m_markers.size()*mcv::marker::SIGNATURE_WORDS);
+        for(int i = 0; i < (int)m_markers.size(); ++i){
+            mcv::marker::compute_signature(m_markers[i], &(m_signatures[(size_t)i*mcv::marker::SIGNATURE_WORDS]));
+            insertChunks(i, false);
+        }
+        for(std::vector<std::pair<uint16_t, int>>& entries : m_chunk_entries){
+            std::sort(entries.begin(), entries.end());
+        }
+    }
+}
+
+void mcv::Matcher::indexMarker(int index) {
+    m_signatures.resize((size_t)(index+1)*mcv::marker::SIGNATURE_WORDS);
+    mcv::marker::compute_signature(m_markers[index], &(m_signatures[(size_t)index*mcv::marker::SIGNATURE_WORDS]));
+    insertChunks(index, true);
+}
+
+void mcv::Matcher::insertChunks(int index, bool sorted) {
+    const uint64_t* signature = &(m_signatures[(size_t)index*mcv::marker::SIGNATURE_WORDS]);
+    for(int c = 0; c < SIGNATURE_CHUNKS; ++c){
+        const std::pair<uint16_t, int> entry(signature_chunk(signature, c), index);
+        std::vector<std::pair<uint16_t, int>>& entries = m_chunk_entries[c];
+        entries.insert(sorted ? std::upper_bound(entries.begin(), entries.end(), entry) : entries.end(), entry);
+        m_chunk_bitmaps[(size_t)c*1024 + entry.first/64] |= (uint64_t)1 << (entry.first%64);
+    }
+}
+
+void mcv::Matcher::findCoarseMarkers(const uint64_t* signature, std::vector<std::pair<int, int>>& coarse_markers) const {
+    coarse_markers.clear();
+    if((int)m_markers.size() <= COARSE_INDEX_MIN_MARKERS){
+        // Small library: all signatures are compared
+        for(int i = 0; i < (int)m_markers.size(); ++i){
+            coarse_markers.push_back(std::pair<int, int>(signature_distance(&(m_signatures[(size_t)i*mcv::marker::SIGNATURE_WORDS]), signature), i));
+        }
+        std::partial_sort(coarse_markers.begin(), coarse_markers.begin()+m_coarse_candidates, coarse_markers.end());
+        coarse_markers.resize((size_t)m_coarse_candidates);
+        return;
+    }
+
+    // Masks are the same for all matchers, they are built by the first call
+    static const ChunkProbes probes = chunk_probes(COARSE_CHUNK_RADIUS);
+    const std::vector<uint16_t>& masks = probes.masks;
+    const std::vector<int>& level_end = probes.level_end;
+
+    // Markers are searched with radius 0, 1, ... in all chunks: after radius r all markers with distance lower than
+    // SIGNATURE_CHUNKS*(r+1) have been found, search stops as soon as they are enough
+    int level_begin = 0;
+    for(int r = 0; r <= COARSE_CHUNK_RADIUS; ++r){
+        const size_t found = coarse_markers.size();
+        for(int c = 0; c < SIGNATURE_CHUNKS; ++c){
+            const uint16_t chunk = signature_chunk(signature, c);
+            const uint64_t* bitmap = &(m_chunk_bitmaps[(size_t)c*1024]);
+            const std::vector<std::pair<uint16_t, int>>& entries = m_chunk_entries[c];
+            for(int m = level_begin; m < level_end[r]; ++m){
+                const uint16_t value = chunk ^ masks[m];
+                if(!(bitmap[value/64] & ((uint64_t)1 << (value%64)))){
+                    continue;
+                }
+                auto it = std::lower_bound(entries.begin(), entries.end(), std::pair<uint16_t, int>(value, -1));
+                for(; it != entries.end() && it->first == value; ++it){
+                    coarse_markers.push_back(std::pair<int, int>(-1, it->second));
+                }
+            }
+        }
+        level_begin = level_end[r];
+
+        // A marker can be found by more chunks and radii: markers are kept sorted by index with known distances
+        // first, so duplicates are dropped and distance is computed once for each marker
+        if(coarse_markers.size() > found){
+            std::sort(coarse_markers.begin(), coarse_markers.end(),
+                      [](const std::pair<int, int>& a, const std::pair<int, int>& b){
+                          return a.second < b.second || (a.second == b.second && a.first > b.first);
+                      });
+            coarse_markers.erase(std::unique(coarse_markers.begin(), coarse_markers.end(),
+                                             [](const std::pair<int, int>& a, const std::pair<int, int>& b){ return a.second == b.second; }),
+                                 coarse_markers.end());
+            for(std::pair<int, int>& marker : coarse_markers){
+                if(marker.first >= 0)continue;
+                marker.first = signature_distance(&(m_signatures[(size_t)marker.second*mcv::marker::SIGNATURE_WORDS]), signature);
+            }
+        }
+
+        const int bound = SIGNATURE_CHUNKS*(r+1);
+        const long close = std::count_if(coarse_markers.begin(), coarse_markers.end(),
+                                         [bound](const std::pair<int, int>& marker){ return marker.first < bound; });
+        if(close >= m_coarse_candidates){
+            break;
+        }
+    }
+
+    // Best signature scores first ( ties broken by marker index to be deterministic )
+    const size_t kept = std::min(coarse_markers.size(), (size_t)m_coarse_candidates);
+    std::partial_sort(coarse_markers.begin(), coarse_markers.begin()+kept, coarse_markers.end());
+    coarse_markers.resize(kept);
+}
+
+void mcv::Matcher::setBoundedScoring(bool bounded) {
+    m_bounded = bounded;
+}
+
+float mcv::Matcher::scoreMarker(int index, const cv::Mat& frame_to_match, const uint64_t* candidate_bits, float bound, int* skipped_rows) const {
+    if(m_mode == match_mode::BIT_PACKED){
+        const uint64_t* marker_bits = &(m_packed_markers[(size_t)index*m_packed_words]);
+        if(m_bounded){
+            return mcv::marker::compute_matching_bits_bounded(marker_bits, candidate_bits, frame_to_match.rows, frame_to_match.cols, bound, skipped_rows);
+        }
+        const int pixels = frame_to_match.rows*frame_to_match.cols;
+        return mcv::marker::compute_matching_bits(marker_bits, candidate_bits, m_packed_words, pixels);
+    }
+    if(m_bounded){
+        return mcv::marker::compute_matching_bounded(m_markers[index], frame_to_match, bound, skipped_rows);
+    }
+    return mcv::marker::compute_matching(m_markers[index], frame_to_match);
+}
+
+const uint64_t* mcv::Matcher::packCandidate(const cv::Mat& frame_to_match, uint64_t* stack_bits, std::vector<uint64_t>& heap_bits) const {
+    if(m_mode != match_mode::BIT_PACKED){
         return nullptr;
     }
+    assert(mcv::marker::packed_words(frame_to_match.rows, frame_to_match.cols) == m_packed_words && "Dimensions mismatch");
+    uint64_t* candidate_bits = stack_bits;
+    if(m_packed_words > STACK_WORDS){
+        heap_bits.resize((size_t)m_packed_words);
+        candidate_bits = heap_bits.data();
+    }
+    mcv::marker::pack_bits(frame_to_match, candidate_bits);
+    return candidate_bits;
+}
+
+void mcv::Matcher::computeScores(const cv::Mat& frame_to_match, const float threshold, ScoreBuffers& buffers, int* skipped_rows) const {
+    std::vector<float>& scores = buffers.scores;
+    buffers.indices.clear();
+    if(m_markers.empty()){
+        scores.clear();
+        return;
+    }
+    // Best score found so far, a marker which can't reach max(threshold, best) can be stopped
+    float best = -1.0f;
+
+    uint64_t stack_bits[STACK_WORDS];
+    std::vector<uint64_t> heap_bits;
+    const uint64_t* candidate_bits = packCandidate(frame_to_match, stack_bits, heap_bits);
+
+    if(m_coarse_candidates == 0 || m_coarse_candidates >= (int)m_markers.size()){
+        scores.resize(m_markers.size()); // capacity kept between calls
+        for(int i=0; i < (int)scores.size(); ++i){
+            scores[i] = scoreMarker(i, frame_to_match, candidate_bits, std::max(threshold, best), skipped_rows);
+            best = std::max(best, scores[i]);
+        }
+        return;
+    }
+
+    // Coarse step: find the markers with the best signatures through the signature index
+    uint64_t candidate_signature[mcv::marker::SIGNATURE_WORDS];
+    mcv::marker::compute_signature(frame_to_match, candidate_signature);
+    std::vector<std::pair<int, int>>& coarse_markers = buffers.coarse_markers;
+    findCoarseMarkers(candidate_signature, coarse_markers);
+
+    // Fine step: full comparison only for the survived markers, the others can't be matched
+    // ( best signatures first, so the bound grows quickly )
+    scores.resize(coarse_markers.size());
+    buffers.indices.resize(coarse_markers.size());
+    for(int k=0; k < (int)coarse_markers.size(); ++k){
+        const int i = coarse_markers[k].second;
+        scores[k] = scoreMarker(i, frame_to_match, candidate_bits, std::max(threshold, best), skipped_rows);
+        buffers.indices[k] = i;
+        best = std::max(best, scores[k]);
+    }
+}
+
+int mcv::Matcher::findBestMatchIndex(const cv::Mat& frame_to_match, const float threshold, int* skipped_rows, float* best_score,
+                                     ScoreBuffers* buffers) const {
+    ScoreBuffers local_buffers;
+    if(buffers == nullptr){
+        buffers = &local_buffers;
+    }
+    computeScores(frame_to_match, threshold, *buffers, skipped_rows);
+    const std::vector<float>& scores = buffers->scores;
+    const std::vector<int>& indices = buffers->indices;
+
+    int max_index = -1;
+    float max = 0.0f;
+    if(indices.empty()){
+        max_index = maxIndex(scores);
+        max = max_index > -1 ? scores[max_index] : 0.0f;
+    }else{
+        // Only markers selected by coarse matching have a score, ties go to the last marker as maxIndex does
+        for(int k = 0; k < (int)scores.size(); ++k){
+            if(scores[k] > max || (scores[k] == max && indices[k] > max_index)){
+                max = scores[k];
+                max_index = indices[k];
+            }
+        }
+    }
+    if(best_score != nullptr){
+        *best_score = max;
+    }
+    if(max_index > -1 && max > threshold){
+        return max_index;
+    }else{
+        return -1;
+    }
+}
+
+const cv::Mat* mcv::Matcher::findBestMatch(const cv::Mat& frame_to_match, const float threshold, int* skipped_rows) const {
+    const int index = findBestMatchIndex(frame_to_match, threshold, skipped_rows);
+    return index > -1 ? &(m_replacements[index]) : nullptr;
+}
+
+float mcv::Matcher::computeScore(int index, const cv::Mat& frame_to_match, const float threshold) const {
+    assert(index >= 0 && index < (int)m_markers.size() && "Marker index out of range");
+    uint64_t stack_bits[STACK_WORDS];
+    std::vector<uint64_t> heap_bits;
+    const uint64_t* candidate_bits = packCandidate(frame_to_match, stack_bits, heap_bits);
+    return scoreMarker(index, frame_to_match, candidate_bits, threshold, nullptr);
+}
+
+float mcv::Matcher::verifyScore(int index, const cv::Mat& full_frame, const float threshold) const {
+    assert(index >= 0 && index < (int)m_full_markers.size() && "Marker index out of range");
+    return mcv::marker::compute_matching_bounded(m_full_markers[index], full_frame, threshold);
 }
@@ -7,19 +7,229 @@
 
 
 #include <vector>
+#include <utility>
+#include <stdint.h>
 #include <opencv2/core/mat.hpp>
 
 namespace mcv{
+
+    /**
+     * Implementations of the comparison between a candidate and the markers
+     */
+    enum class match_mode{
+        INTENSITY, // mcv::marker::compute_matching on each pixel intensity
+        BIT_PACKED // markers and candidate packed into 1 bit per pixel and compared with XOR and popcount
+    };
+
     class Matcher {
+    public:
+        /**
+         * Scratch vectors of a match, a caller which matches many candidates keeps one ( for each thread ) so they
+         * are allocated only by the first matches
+         */
+        struct ScoreBuffers {
+            std::vector<float> scores; // one score for each compared marker
+            std::vector<int> indices; // marker of each score with coarse matching, otherwise scores are in marker order
+            std::vector<std::pair<int, int>> coarse_markers; // signature distance and index of markers found by the
+                                                             // signature index
+        };
+
     private:
-        const std::vector<const cv::Mat*> m_markers;
-        const std::vector<const cv::Mat*> m_replacements;
+        std::vector<cv::Mat> m_markers; // markers warped into the canvas, compared with candidates
+        std::vector<cv::Mat> m_full_markers; // markers at mcv::marker::CANVAS_SIZE, used to verify candidates at full size
+        std::vector<cv::Mat> m_replacements;
+        // Size of the square canvas where candidates are matched ( see setCanvasSize ), mcv::marker::CANVAS_SIZE by
+        // default ( set by the constructors, marker.h includes this header )
+        int m_canvas_size;
+        match_mode m_mode = match_mode::INTENSITY;
+        // All markers packed with mcv::marker::pack_bits, m_packed_words words for each marker
+        std::vector<uint64_t> m_packed_markers;
+        int m_packed_words = 0;
+        // Signatures of all markers ( mcv::marker::SIGNATURE_WORDS words each ) used to discard markers cheaply
+        std::vector<uint64_t> m_signatures;
+        // Signatures are split into SIGNATURE_CHUNKS chunks of 16 bits, two signatures which differ in less than
+        // SIGNATURE_CHUNKS*(r+1) bits have at least one chunk which differs in r bits or less ( multi-index hashing )
+        static const int SIGNATURE_CHUNKS = 16;
+        // Max number of different bits of a chunk probed by the signature index, so markers whose signature differs
+        // from the candidate one in less than SIGNATURE_CHUNKS*(COARSE_CHUNK_RADIUS+1) bits are always found
+        static const int COARSE_CHUNK_RADIUS = 2;
+        // For each chunk the value of that chunk and the index of each marker, sorted by value
+        std::vector<std::pair<uint16_t, int>> m_chunk_entries[SIGNATURE_CHUNKS];
+        // For each chunk a bit for each of its 65536 values, set if at least one marker has it ( most probes miss )
+        std::vector<uint64_t> m_chunk_bitmaps;
+        // Number of markers with best signature score that are fully compared, 0 means all markers
+        int m_coarse_candidates = 0;
+        // If true comparison with a marker stops when it can't reach the threshold or the best score found so far
+        bool m_bounded = true;
+
+        /**
+         * Pack marker at "index" and append it to m_packed_markers
+         */
+        void packMarker(int index);
+
+        /**
+         * Compute signature of marker at "index", append it to m_signatures and insert its chunks into the index
+         */
+        void indexMarker(int index);
+
+        /**
+         * Add chunks of signature at "index" to the index
+         * @param sorted: if true entries are inserted at their position, otherwise they are appended and the caller sorts
+         */
+        void insertChunks(int index, bool sorted);
+
+        /**
+         * Find the markers with the best signature score: small libraries compare all signatures, larger ones use the
+         * signature index, the same result if at least "m_coarse_candidates" markers differ in less than
+         * SIGNATURE_CHUNKS*(COARSE_CHUNK_RADIUS+1) bits, otherwise only markers found are kept
+         * @param signature: signature of the candidate
+         * @param coarse_markers: output, signature distance and index of up to m_coarse_candidates markers, best first
+         */
+        void findCoarseMarkers(const uint64_t* signature, std::vector<std::pair<int, int>>& coarse_markers) const;
+
+        /**
+         * Warp marker at "index" of m_full_markers into the canvas as candidates are warped and store it into m_markers
+         */
+        void resampleMarker(int index);
+
+        // Candidates up to STACK_WORDS packed words ( 256x256 ) are packed on the stack
+        static const int STACK_WORDS = 1024;
+
+        /**
+         * Pack "frame_to_match" with mcv::marker::pack_bits if the mode is BIT_PACKED
+         * @param stack_bits: buffer of STACK_WORDS words used when it is large enough
+         * @param heap_bits: buffer used for larger candidates
+         * @return packed candidate or nullptr if the mode is not BIT_PACKED
+         */
+        const uint64_t* packCandidate(const cv::Mat& frame_to_match, uint64_t* stack_bits, std::vector<uint64_t>& heap_bits) const;
+
+        /**
+         * Full comparison between marker at "index" and the candidate
+         * @param candidate_bits: candidate packed with mcv::marker::pack_bits ( used only in BIT_PACKED mode )
+         * @param bound: score to reach, used only if m_bounded is true
+         * @param skipped_rows: if not null rows not compared are added to it
+         */
+        float scoreMarker(int index, const cv::Mat& frame_to_match, const uint64_t* candidate_bits, float bound, int* skipped_rows) const;
+
+        /**
+         * Compute similarity of "frame_to_match" with all markers or with markers selected by coarse matching, a marker
+         * which can't be the best match over "threshold" can have a score lower than the real one
+         * ( see setBoundedScoring )
+         * @param buffers: output, scores holds one score for each compared marker and indices their markers
+         * @param skipped_rows: if not null rows not compared are added to it
+         */
+        void computeScores(const cv::Mat& frame_to_match, const float threshold, ScoreBuffers& buffers, int* skipped_rows) const;
     public:
+        Matcher();
         Matcher(
                 const std::vector<const cv::Mat*>& markers,
                 const std::vector<const cv::Mat*>& replacements
         );
-        const cv::Mat* findBestMatch(const cv::Mat& frame_to_match, const float threshold) const;
+
+        /**
+         * Register a new marker, marker and replacement are copied so the caller can release them
+         * @param marker: thresholded square single channel marker ( 256x256 ), other sizes are resampled to 256x256 and
+         * to the canvas size for matching
+         * @param replacement: image which will replace the marker when it is found
+         * @return index of the marker or -1 if marker isn't a square single channel image
+         */
+        int addMarker(const cv::Mat& marker, const cv::Mat& replacement);
+
+        /**
+         * @return number of registered markers
+         */
+        inline int size() const {
+            return (int)m_markers.size();
+        }
+
+        /**
+         * Select how candidates are compared with markers ( INTENSITY by default ), BIT_PACKED reports the same score
+         * of INTENSITY for binary images ( fraction of equal pixels ) so the same threshold can be used. Candidates
+         * warped with bilinear interpolation aren't binary near edges and pack_bits thresholds them, so scores close
+         * to the threshold can differ: compare detections of both modes with picturear-batch --bit-packed before
+         * switching
+         * @param mode: comparison implementation
+         */
+        void setMode(match_mode mode);
+
+        /**
+         * Select the size of the square canvas where candidates are matched ( mcv::marker::CANVAS_SIZE by default ), markers are warped
+         * into it with the same scale and bilinear interpolation used for candidates ( see
+         * mcv::marker::canvas_homography ): a 64x64 canvas has 16 times fewer pixels to warp and compare than a
+         * 256x256 one. Detection rates of smaller canvases haven't been measured yet
+         * @param canvas_size: size of the canvas, at least mcv::marker::SIGNATURE_SIZE
+         */
+        void setCanvasSize(int canvas_size);
+
+        /**
+         * @return size of the square canvas where candidates are matched
+         */
+        inline int getCanvasSize() const {
+            return m_canvas_size;
+        }
+
+        /**
+         * Enable coarse to fine matching: signatures of the markers ( see mcv::marker::compute_signature ) are indexed
+         * by their 16 bit chunks and only the "candidates" markers with the best signature score are fully compared,
+         * markers not compared can't be matched. The index probes chunk values with up to COARSE_CHUNK_RADIUS different
+         * bits, so a candidate doesn't read the signatures of all markers: markers whose signature differs from the
+         * candidate one in more than 47 of 256 bits can be skipped even if less than "candidates" markers are found.
+         * Libraries up to 512 markers compare all signatures, probing the index costs more
+         * ( e.g. 2 markers gain nothing: with "candidates" >= 2 all of them are fully compared )
+         * @param candidates: number of markers fully compared, 0 disables coarse matching ( all markers are compared )
+         */
+        void setCoarseCandidates(int candidates);
+
+        /**
+         * Enable or disable bounded scoring ( enabled by default ): comparison with a marker stops as soon as the
+         * remaining rows can't lift its score over the threshold or over the best score found so far, the best match
+         * is the same of the full comparison
+         * @param bounded: true to enable bounded scoring
+         */
+        void setBoundedScoring(bool bounded);
+
+        /**
+         * Find marker most similar to "frame_to_match"
+         * @param frame_to_match: candidate marker extracted from frame
+         * @param threshold: min score to consider the candidate as a marker
+         * @param skipped_rows: if not null the number of rows that bounded scoring didn't compare is added to it
+         * @return replacement of the best marker or nullptr if there isn't a marker with score over threshold
+         */
+        const cv::Mat* findBestMatch(const cv::Mat& frame_to_match, const float threshold, int* skipped_rows = nullptr) const;
+
+        /**
+         * Same of findBestMatch but it returns the index of the best marker
+         * @param best_score: if not null score of the best marker
+         * @param buffers: if not null scratch vectors reused between calls, otherwise they are allocated by each call
+         * @return index of the best marker or -1 if there isn't a marker with score over threshold
+         */
+        int findBestMatchIndex(const cv::Mat& frame_to_match, const float threshold, int* skipped_rows = nullptr, float* best_score = nullptr,
+                               ScoreBuffers* buffers = nullptr) const;
+
+        /**
+         * Compare "frame_to_match" with a single marker, used to verify a marker already matched in previous frames
+         * @param index: index of the marker
+         * @param threshold: with bounded scoring the returned score is exact only if it is over threshold
+         * @return similarity between marker and candidate
+         */
+        float computeScore(int index, const cv::Mat& frame_to_match, const float threshold) const;
+
+        /**
+         * Compare a candidate warped at the size of the registered markers with the marker at "index", it confirms a
+         * match found on a smaller canvas whose score is close to the threshold
+         * @param index: index of the marker
+         * @param full_frame: candidate with the same size of the registered marker
+         * @param threshold: the returned score is exact only if it is over threshold
+         * @return similarity between marker and candidate
+         */
+        float verifyScore(int index, const cv::Mat& full_frame, const float threshold) const;
+
+        /**
+         * @return replacement of the marker at "index"
+         */
+        inline const cv::Mat& getReplacement(int index) const {
+            return m_replacements[index];
+        }
     };
 }
 
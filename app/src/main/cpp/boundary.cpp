@@ -3,30 +3,141 @@
 //
 
 #include "boundary.h"
+#include <opencv2/imgproc.hpp>
+#include <assert.h>
+
+/*
+ * Freeman codes of the 8 neighbours:
+ *
+ * 3  2  1
+ * 4  b  0
+ * 5  6  7
+ */
+static const int FREEMAN_DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int FREEMAN_DY[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+// Freeman code of the step (dx,dy) at index (dy+1)*3+(dx+1), -1 if it isn't a step between neighbours
+static const int FREEMAN_CODE[9] = {3, 2, 1, 4, -1, 0, 5, 6, 7};
+
+mcv::boundary::boundary(boundary_storage storage, int max_length, frame_arena* arena, bool keep_walk):
+        points(point_vector::allocator_type(arena)),
+        corners(point_vector::allocator_type(arena)),
+        chain(code_vector::allocator_type(arena)),
+        storage(storage),
+        max_length(max_length),
+        keep_walk(keep_walk){}
+
+mcv::boundary::point_iterator::point_iterator(const boundary* b, int index, bool walk):b_(b),index_(index){
+    end_ = walk ? b_->walk_size() : b_->size();
+    decode_ = walk || b_->storage == boundary_storage::CHAIN_CODE;
+    if(index_ >= end_)return; // end iterator
+    if(!decode_){
+        point_ = b_->points[index_];
+        return;
+    }
+    // Decode all steps before index
+    point_ = b_->start;
+    for(int i = 0; i < index_; ++i){
+        const int code = (int)((b_->chain[i/CODES_PER_WORD] >> ((i%CODES_PER_WORD)*3)) & 7);
+        point_[0] += FREEMAN_DX[code];
+        point_[1] += FREEMAN_DY[code];
+    }
+}
+
+mcv::boundary::point_iterator& mcv::boundary::point_iterator::operator++() {
+    ++index_;
+    if(index_ >= end_)return *this;
+    if(!decode_){
+        point_ = b_->points[index_];
+    }else{
+        // code index_-1 is the step from the previous point to the current one
+        const int i = index_-1;
+        const int code = (int)((b_->chain[i/CODES_PER_WORD] >> ((i%CODES_PER_WORD)*3)) & 7);
+        point_[0] += FREEMAN_DX[code];
+        point_[1] += FREEMAN_DY[code];
+    }
+    return *this;
+}
+
+void mcv::boundary::add_code(const cv::Vec2i& b) {
+    if(length == 1){
+        start = b;
+        last_ = b;
+        return;
+    }
+    push_code(b, length-2);
+}
+
+void mcv::boundary::push_code(const cv::Vec2i& b, int i) {
+    const int dx = b[0]-last_[0];
+    const int dy = b[1]-last_[1];
+    assert(dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1 && "Chain code needs neighbour points");
+    const int code = FREEMAN_CODE[(dy+1)*3+(dx+1)];
+    assert(code >= 0 && "Chain code needs different points");
+
+    if(i%CODES_PER_WORD == 0){
+        chain.push_back(0);
+    }
+    chain.back() |= ((uint64_t)code) << ((i%CODES_PER_WORD)*3);
+    last_ = b;
+}
+
+void mcv::boundary::abandon() {
+    abandoned = true;
+    if(keep_walk){
+        // chain codes already hold the walk in CHAIN_CODE storage, stored points are encoded otherwise
+        if(storage == boundary_storage::POINTS && !points.empty()){
+            start = points[0];
+            last_ = points[0];
+            for(int i = 1; i < (int)points.size(); ++i){
+                push_code(points[i], i-1);
+            }
+        }
+        point_vector(points.get_allocator()).swap(points);
+        return;
+    }
+    // swap releases memory, clear would keep it
+    point_vector(points.get_allocator()).swap(points);
+    code_vector(chain.get_allocator()).swap(chain);
+}
+
+void mcv::boundary::translate(int dx, int dy) {
+    if(storage == boundary_storage::POINTS){
+        for(cv::Vec2i& v : points){
+            v[0] += dx;
+            v[1] += dy;
+        }
+    }else{
+        start[0] += dx;
+        start[1] += dy;
+        last_[0] += dx;
+        last_[1] += dy;
+    }
+}
 
 void mcv::boundary::print(){
     std::cout << "Boundary:" << std::endl;
-    for (cv::Vec2i& v : points) {
+    for (const cv::Vec2i& v : *this) {
         std::cout << "(" << v[0] << "," << v[1] << ")" << std::endl;
     }
 }
 
-void mcv::boundary::compute_corners(cv::Mat& img_corners){
+void mcv::boundary::compute_corners(const cv::Mat& img_corners, const cv::Point& offset){
     const float CORNER_THRESHOLD = 2.0f;
     int kernel_size = 0; // kernel_size greater than zero was used to improve corners before cornerSubPix optimization
     bool on_corner = false;
-    cv::Vec2i* corner = nullptr;
+    cv::Vec2i corner;
     float corner_intensity = 0.0f; // Intensity of the corners
-    for(int i = 0; i < points.size(); ++i) {
-        cv::Vec2i &point = points[i];
+    for(const cv::Vec2i& point : *this) {
 
         // Calculate intensity based on neighbourhood
         float current_intensity = 0.0f;
         const float *p;
-        for(int y = point[1]+1-kernel_size; y <= point[1]+1+kernel_size; ++y) { // Added 1px because img_corners is an image with padding
+        const int point_x = point[0] + 1 - offset.x; // Added 1px because img_corners is an image with padding
+        const int point_y = point[1] + 1 - offset.y;
+        for(int y = point_y-kernel_size; y <= point_y+kernel_size; ++y) {
             if (y >= 0 && y < img_corners.rows) { // Bound checking
                 p = img_corners.ptr<float>(y);
-                for (int x = point[0] + 1 - kernel_size; x <= point[0] + 1 + kernel_size; ++x) {
+                for (int x = point_x - kernel_size; x <= point_x + kernel_size; ++x) {
                     if (x >= 0 && x < img_corners.cols) { // Bound checking for neighbour technique
                         current_intensity += p[x];
                     }
@@ -42,19 +153,36 @@ void mcv::boundary::compute_corners(cv::Mat& img_corners){
             // pixel already on the corner but if the current intensity is greater respect to the previous one, update corner
             if(current_intensity>corner_intensity){
                 corner_intensity = current_intensity;
-                corner = &point; // Use reference to point to avoid normalization problem
+                corner = point; // copy because chain code points are decoded on the fly
             }
         }else{
             if(on_corner){
                 corners_number += 1;
-                corners.push_back(*corner); // Copy point to corners set
+                corners.push_back(corner); // Copy point to corners set
                 // Reset values for next corner
                 on_corner = false;
                 corner_intensity = 0.0f;
-                corner = nullptr;
             }
         }
 
     }
 }
 
+void mcv::boundary::compute_corners_polygon(double epsilon){
+    corners.clear();
+    if(size() < 3){
+        corners_number = 0;
+        return;
+    }
+    // Vertices of the approximation are copied from points so they are real boundary pixels
+    std::vector<cv::Vec2i> vertices;
+    if(storage == boundary_storage::POINTS) {
+        // header on points, no copy
+        cv::approxPolyDP(cv::Mat((int)points.size(), 1, CV_32SC2, points.data()), vertices, epsilon, true);
+    }else{
+        std::vector<cv::Vec2i> decoded(begin(), end()); // approxPolyDP needs contiguous points
+        cv::approxPolyDP(decoded, vertices, epsilon, true);
+    }
+    corners.assign(vertices.begin(), vertices.end());
+    corners_number = (int)corners.size();
+}
@@ -7,9 +7,21 @@
 
 #include <iostream>
 #include <vector>
+#include <stdint.h>
+#include <iterator>
 #include <opencv2/core/core.hpp>
+#include "frame_arena.h"
 
 namespace mcv{
+
+    /**
+     * How the points of a boundary are stored
+     */
+    enum class boundary_storage{
+        POINTS, // each point stored as cv::Vec2i into boundary::points
+        CHAIN_CODE // first point plus 3 bits Freeman code for each following point, decoded on demand
+    };
+
     class boundary{
     public:
         int min_x = -1;
@@ -18,14 +30,89 @@ namespace mcv{
         int max_y = -1;
         int length = 0; // Length of the boundary
         int corners_number = 0;
+        int first_corner = -1; // index of the first corner into the float corner store of boundary_extractor
+
+        // Vectors of the boundary, their memory comes from a frame_arena if the boundary has been created with it
+        typedef std::vector<cv::Vec2i, arena_allocator<cv::Vec2i>> point_vector;
+        typedef std::vector<uint64_t, arena_allocator<uint64_t>> code_vector;
 
-        // Set of points which compose the boundary
-        std::vector<cv::Vec2i> points; // clock wise ordered
+        // Set of points which compose the boundary ( POINTS storage )
+        point_vector points; // clock wise ordered
         // Set of point which compose the corners
-        std::vector<cv::Vec2i> corners; // clock wise ordered
+        point_vector corners; // clock wise ordered
+
+        // Number of Freeman codes packed into each word of chain
+        static const int CODES_PER_WORD = 21;
+
+        // First point and chain codes of the following ones ( CHAIN_CODE storage )
+        cv::Vec2i start = cv::Vec2i(-1,-1);
+        code_vector chain; // CODES_PER_WORD codes of 3 bits for each word, lowest bits first
+
+        boundary_storage storage = boundary_storage::POINTS;
+        // Max length stored, over this length stored points are released and only length and bounding box are updated
+        // ( 0 means no limit )
+        int max_length = 0;
+        bool abandoned = false; // true if the boundary went over max_length
+        // If true an abandoned boundary keeps the chain codes of all its points so its walk can be replayed
+        // ( see walk_begin ), points are still not stored
+        bool keep_walk = false;
+
+        /**
+         * Forward iterator over boundary points which works with both storages, chain codes are decoded on the fly
+         */
+        class point_iterator{
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef cv::Vec2i value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const cv::Vec2i* pointer;
+            typedef const cv::Vec2i& reference;
+
+            /**
+             * @param walk: if true the iterator decodes the walk of an abandoned boundary ( see walk_begin )
+             */
+            point_iterator(const boundary* b, int index, bool walk = false);
+
+            inline const cv::Vec2i& operator*() const {
+                return point_;
+            }
+
+            inline const cv::Vec2i* operator->() const {
+                return &point_;
+            }
+
+            inline bool operator!=(const point_iterator& other) const {
+                return index_ != other.index_;
+            }
+
+            inline bool operator==(const point_iterator& other) const {
+                return index_ == other.index_;
+            }
+
+            point_iterator& operator++();
+
+        private:
+            const boundary* b_;
+            int index_;
+            int end_; // number of points visited by the iterator
+            bool decode_; // true if points are decoded from chain codes
+            cv::Vec2i point_;
+        };
+
+        boundary() = default;
+
+        /**
+         * @param storage: how points are stored
+         * @param max_length: max length stored ( 0 means no limit )
+         * @param arena: if not null all vectors of the boundary are allocated from it, the boundary must be destroyed
+         * before the arena is reset
+         * @param keep_walk: if true chain codes of all points are kept when the boundary is abandoned
+         */
+        boundary(boundary_storage storage, int max_length = 0, frame_arena* arena = nullptr, bool keep_walk = false);
 
         /**
-         * This function allows to add a point to the current boundary
+         * This function allows to add a point to the current boundary, each point must be a neighbour of the previous
+         * one in CHAIN_CODE storage
          * @param b: point to add into boundary
          */
         void add_item(cv::Vec2i& b){
@@ -35,9 +122,61 @@ namespace mcv{
             if(b[0]>max_x || max_x == -1)max_x = b[0];
             if(b[1]<min_y || min_y == -1)min_y = b[1];
             if(b[1]>max_y || max_y == -1)max_y = b[1];
-            points.push_back(b); // add pixel to boundary points
+            if(!abandoned && max_length > 0 && length > max_length){
+                abandon();
+            }
+            if(abandoned){
+                // only length and bounding box are still tracked, and the walk if it is kept
+                if(keep_walk)add_code(b);
+                return;
+            }
+            if(storage == boundary_storage::POINTS) {
+                points.push_back(b); // add pixel to boundary points
+            }else{
+                add_code(b);
+            }
         }
 
+        /**
+         * @return number of stored points, zero if the boundary has been abandoned
+         */
+        inline int size() const {
+            if(abandoned)return 0;
+            return (storage == boundary_storage::POINTS)? (int)points.size() : length;
+        }
+
+        inline point_iterator begin() const {
+            return point_iterator(this, 0);
+        }
+
+        inline point_iterator end() const {
+            return point_iterator(this, size());
+        }
+
+        /**
+         * Iterators over all points walked by an abandoned boundary created with keep_walk ( length points decoded
+         * from chain codes ), empty for other boundaries
+         */
+        inline point_iterator walk_begin() const {
+            return point_iterator(this, 0, true);
+        }
+
+        inline point_iterator walk_end() const {
+            return point_iterator(this, walk_size(), true);
+        }
+
+        /**
+         * @return number of points of the walk kept by an abandoned boundary, zero for other boundaries
+         */
+        inline int walk_size() const {
+            return (abandoned && keep_walk)? length : 0;
+        }
+
+        /**
+         * Move all stored points of (dx,dy), bounding box is not changed
+         */
+        void translate(int dx, int dy);
+
         /**
          * This function prints all boundaries
          */
@@ -46,8 +185,36 @@ namespace mcv{
         /**
          * This function computes boundary corners from a harrisCorner output image
          * @param img_corners: grayscale image extracted from harrisCorner detection
+         * @param offset: position of img_corners into the padded image, it is not zero if img_corners has been computed
+         * only on a region of interest
+         */
+        void compute_corners(const cv::Mat& img_corners, const cv::Point& offset = cv::Point(0,0));
+
+        /**
+         * This function computes boundary corners as vertices of the polygon which approximates the closed boundary
+         * ( Douglas-Peucker, cv::approxPolyDP ), corners are points of the boundary in clock wise order
+         * @param epsilon: max distance between boundary points and polygon sides
+         */
+        void compute_corners_polygon(double epsilon);
+
+    private:
+        cv::Vec2i last_; // last point added in CHAIN_CODE storage
+
+        /**
+         * Append Freeman code of the step between last_ and "b"
+         */
+        void add_code(const cv::Vec2i& b);
+
+        /**
+         * Append Freeman code of the step between last_ and "b" as code number "i" of chain
+         */
+        void push_code(const cv::Vec2i& b, int i);
+
+        /**
+         * Release all stored points, boundary keeps only length and bounding box ( and chain codes with keep_walk,
+         * points already stored are encoded into chain codes )
          */
-        void compute_corners(cv::Mat& img_corners);
+        void abandon();
     };
 
 
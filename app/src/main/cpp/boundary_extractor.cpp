@@ -3,15 +3,31 @@
 //
 
 #include <iostream>
+#include <algorithm>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
 #include <opencv2/imgcodecs/legacy/constants_c.h>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/core/utility.hpp>
 
 #include "boundary_extractor.h"
 #include "utils.h"
 
 using namespace mcv;
 
+/*
+ * Lookup tables used by moore_algorithm_table, clock index are the same of find_clock_index:
+ *
+ * 0  1  2
+ * 7  b  3
+ * 6  5  4
+ */
+// x and y offset of each clock index respect to the center b
+static const int CLOCK_DX[8] = {-1, 0, 1, 1, 1, 0, -1, -1};
+static const int CLOCK_DY[8] = {-1, -1, -1, 0, 1, 1, 1, 0};
+// Clock index of the new c respect to the new b when b moves to the given clock index
+// ( new c is the previous clock index respect to the old b )
+static const int NEXT_C_INDEX[8] = {5, 7, 7, 1, 1, 3, 3, 5};
+
 boundary_extractor::boundary_extractor(const cv::Mat& image_gray, bool compute_threshold):filename_(""){
 
     assert(image_.channels() == 1 && "Invalid channel number");
@@ -19,7 +35,9 @@ boundary_extractor::boundary_extractor(const cv::Mat& image_gray, bool compute_t
     //compute otsu thresholding
     cv::Mat image;
     if(compute_threshold) {
-        mcv::image_otsu_thresholding(image_gray, image);
+        // Threshold is written directly into the padded image, no copy is necessary
+        mcv::otsu_thresholding_fused(image_gray, image_, 1);
+        return;
     }else{
         image = image_gray; // soft copy
     };
@@ -45,21 +63,115 @@ boundary_extractor::boundary_extractor(const cv::Mat& image_gray, bool compute_t
     }
 }
 
+boundary_extractor::boundary_extractor():filename_(""){}
+
+void boundary_extractor::set_padded_image(const cv::Mat& padded_image) {
+    assert(padded_image.channels() == 1 && "Invalid channel number");
+    image_ = padded_image; // soft copy, the caller owns the buffer
+}
+
 void boundary_extractor::find_boundaries(const uchar boundary_color) {
-    const uchar other_color = (boundary_color==WHITE)? BLACK : WHITE;
     // clear boundaries in order to recompute all
-    boundaries_.clear();
-    // this flag is used to skip white pixels that are close each other
-    bool valid_next = true;
+    clear_boundaries();
+    // no pixel has been traced yet
+    reset_visited();
 
     assert(image_.channels() == 1 && "Invalid channel number");
 
-    int nRows = image_.rows;
+    scan_rows(1, image_.rows-1, boundary_color, visited_, 0, boundaries_, nullptr, use_arena_? &arena_ : nullptr);
+    normalize();
+}
+
+void boundary_extractor::find_boundaries_parallel(const uchar boundary_color, int bands) {
+    // clear boundaries in order to recompute all
+    clear_boundaries();
+    reset_visited();
+
+    assert(image_.channels() == 1 && "Invalid channel number");
+
+    const int first_row = 1;
+    const int last_row = image_.rows-1; // excluded
+    if(bands <= 0)bands = cv::getNumThreads();
+    bands = std::max(1, std::min(bands, last_row-first_row));
+
+    // Split rows into bands with almost the same size
+    std::vector<int> band_rows((size_t)bands+1);
+    for(int k = 0; k <= bands; ++k){
+        band_rows[k] = first_row + (int)(((long long)(last_row-first_row)*k)/bands);
+    }
+
+    // Each band traces boundaries which start in its rows, a band only knows its own boundaries so it can trace a
+    // boundary already traced from a previous band, these duplicates are removed by the merge below
+    // Arenas aren't thread safe so each band allocates from its own
+    while(use_arena_ && band_arenas_.size() < (size_t)bands){
+        band_arenas_.push_back(std::unique_ptr<frame_arena>(new frame_arena()));
+    }
+
+    // Visited maps and candidate vectors of the bands are kept between frames, so they are allocated only when the
+    // number of bands or the frame size change
+    if(band_visited_.size() < (size_t)bands)band_visited_.resize((size_t)bands);
+    if(band_candidates_.size() < (size_t)bands)band_candidates_.resize((size_t)bands);
+
+    std::vector<std::vector<boundary>> band_boundaries((size_t)bands);
+    std::vector<std::vector<band_candidate>>& band_candidates = band_candidates_;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range){
+        for(int k = range.start; k < range.end; ++k){
+            // visited map of the band contains only its rows ( candidates of the band are only there )
+            cv::Mat& band_visited = band_visited_[k];
+            band_visited.create(band_rows[k+1]-band_rows[k], image_.cols, CV_8UC1);
+            band_visited.setTo(0);
+            band_candidates[k].clear();
+            scan_rows(band_rows[k], band_rows[k+1], boundary_color, band_visited, band_rows[k], band_boundaries[k], &(band_candidates[k]),
+                      use_arena_? band_arenas_[k].get() : nullptr);
+        }
+    });
+
+    // Merge following candidates in raster order as the serial find_boundaries does, so the result is the same and
+    // deterministic: a candidate is kept only if it isn't on a boundary already kept
+    for(int k = 0; k < bands; ++k){
+        for(const band_candidate& candidate : band_candidates[k]){
+            if(!is_valid(candidate.x, candidate.y))continue;
+
+            if(candidate.boundary_index >= 0){
+                boundary& b = band_boundaries[k][candidate.boundary_index];
+                if(b.abandoned){
+                    // Over max length: never accepted, its walk kept as chain codes is replayed to mark it
+                    for(boundary::point_iterator p = b.walk_begin(); p != b.walk_end(); ++p){
+                        mark_visited(*p, visited_, 0);
+                    }
+                    continue;
+                }
+                for(const cv::Vec2i& p : b){
+                    mark_visited(p, visited_, 0);
+                }
+                if(is_accepted(b)) {
+                    boundaries_.push_back(std::move(b));
+                }
+            }else{
+                // The band skipped this candidate because it was on a boundary which has been discarded by the merge,
+                // it is walked again to mark it
+                boundary b = trace(candidate.x, candidate.y, boundary_color, visited_, 0, use_arena_? &arena_ : nullptr);
+                if(is_accepted(b)) {
+                    boundaries_.push_back(std::move(b));
+                }
+            }
+        }
+    }
+    normalize();
+}
+
+inline void boundary_extractor::scan_rows(int first_row, int last_row, const uchar boundary_color, cv::Mat& visited,
+                                          int visited_first_row, std::vector<boundary>& boundaries,
+                                          std::vector<band_candidate>* candidates, frame_arena* arena) {
+    const uchar other_color = (boundary_color==WHITE)? BLACK : WHITE;
+    // this flag is used to skip white pixels that are close each other
+    bool valid_next = initial_valid_next(first_row, boundary_color);
+
     int nCols = image_.cols;
 
     int i,j;
     const uchar* p;
-    for( i = 1; i < nRows-1; ++i) {
+    for( i = first_row; i < last_row; ++i) {
         p = image_.ptr<uchar>(i);
         for ( j = 1; j < nCols-1; ++j) {
 
@@ -70,56 +182,147 @@ void boundary_extractor::find_boundaries(const uchar boundary_color) {
             else if(valid_next && (p[j] == boundary_color)){
                 valid_next = false;
                 // if it is a valid boundary point, it finds boundary with moore's algorithm and then it adds to boundaries set
-                if(is_valid(j,i)) {
-                    boundaries_.push_back(moore_algorithm(j, i, boundary_color));
+                bool valid = visited.ptr<uchar>(i-visited_first_row)[j] == 0;
+                if(candidates != nullptr){
+                    candidates->push_back(band_candidate{j, i, valid? (int)boundaries.size() : -1});
+                }
+                if(valid) {
+                    // Bands keep the walk of boundaries over max length, the merge replays it to mark visited pixels
+                    boundary b = trace(j, i, boundary_color, visited, visited_first_row, arena, candidates != nullptr);
+                    // Bands keep also rejected boundaries, the merge needs them to mark visited pixels
+                    if(candidates != nullptr || is_accepted(b)) {
+                        boundaries.push_back(std::move(b));
+                    }
                 }
             }
         }
     }
-    normalize();
 }
 
-inline bool boundary_extractor::is_valid(int x, int y) {
-    for(const boundary& b : boundaries_){
-        // Use boundary max and min corner to avoid to check all pixels of all boundaries already present,
-        // this is very useful to speed-up computation
-        if(x <= b.max_x && x >= b.min_x && y <= b.max_y && y >= b.min_y){
-            // If (x,y) pixel is into a boundary it isn't valid so it returns false
-            if(check_in(b, x, y))return false;
+inline bool boundary_extractor::initial_valid_next(int row, const uchar boundary_color) {
+    const uchar other_color = (boundary_color==WHITE)? BLACK : WHITE;
+    // valid_next depends only on the last pixel with boundary_color or other_color before the row
+    for(int i = row-1; i >= 1; --i){
+        const uchar* p = image_.ptr<uchar>(i);
+        for(int j = image_.cols-2; j >= 1; --j){
+            if(p[j] == other_color)return true;
+            if(p[j] == boundary_color)return false;
         }
     }
     return true;
 }
 
-inline bool boundary_extractor::check_in(const boundary &b, int x, int y) {
-    // check if given point is part of boundary points
-    for(const cv::Vec2i& item : b.points){
-        if((item[0] == x) && (item[1] == y))return true;
+inline void boundary_extractor::clear_boundaries() {
+    // Boundaries give back their memory before arenas are reset
+    boundaries_.clear();
+    arena_.reset();
+    for(std::unique_ptr<frame_arena>& arena : band_arenas_){
+        arena->reset();
+    }
+}
+
+size_t boundary_extractor::get_arena_bytes_used() const {
+    size_t bytes = arena_.bytes_used();
+    for(const std::unique_ptr<frame_arena>& arena : band_arenas_){
+        bytes += arena->bytes_used();
     }
-    return false;
+    return bytes;
+}
+
+inline bool boundary_extractor::is_accepted(const boundary& b) {
+    return (min_length_ <= 0 || b.length >= min_length_) && (max_length_ <= 0 || b.length <= max_length_);
+}
+
+inline void boundary_extractor::reset_visited() {
+    visited_.create(image_.rows, image_.cols, CV_8UC1); // reallocated only if image_ size changes
+    visited_.setTo(0);
+}
+
+inline bool boundary_extractor::is_valid(int x, int y) {
+    // If (x,y) pixel is into a boundary already traced it isn't valid
+    return visited_.ptr<uchar>(y)[x] == 0;
+}
+
+inline void boundary_extractor::mark_visited(const cv::Vec2i& p, cv::Mat& visited, int visited_first_row) {
+    // Boundaries can go outside of the rows of visited ( band visited map ) or into the padding columns, those pixels
+    // will never be a starting point so they can be skipped
+    int y = p[1]-visited_first_row;
+    if(y >= 0 && y < visited.rows && p[0] >= 0 && p[0] < visited.cols) {
+        visited.ptr<uchar>(y)[p[0]] = 1;
+    }
+}
+
+inline void boundary_extractor::add_traced(boundary& b, cv::Vec2i& p, cv::Mat& visited, int visited_first_row) {
+    b.add_item(p);
+    mark_visited(p, visited, visited_first_row); // keep visited aligned with boundary points
+}
 
+inline boundary boundary_extractor::trace(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                                          frame_arena* arena, bool keep_walk) {
+    if(kernel_ == tracing_kernel::TABLE) {
+        return moore_algorithm_table(x, y, boundary_color, visited, visited_first_row, arena, keep_walk);
+    }else{
+        return moore_algorithm(x, y, boundary_color, visited, visited_first_row, arena, keep_walk);
+    }
 }
 
-inline boundary boundary_extractor::moore_algorithm(int x, int y, const uchar boundary_color) {
+inline boundary boundary_extractor::moore_algorithm(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                                                    frame_arena* arena, bool keep_walk) {
     cv::Vec2i b(-1,-1);
     cv::Vec2i c(-1,-1);
-    boundary boundary;
+    boundary boundary(storage_, max_length_, arena, keep_walk); // points are released when it goes over max length
     cv::Vec2i b0(x,y); // b0
     cv::Vec2i c0(x-1,y); // c0
 
     // Add b0 to pixel set
-    boundary.add_item(b0);
+    add_traced(boundary, b0, visited, visited_first_row);
     // search next pixel ( if it is false only if b0 is unique pixel into boundary )
     if(search_clockwise(c0, b0, &c, &b, boundary_color)){
         // Iterate over boundary searching in clockwise until reach already b0
         while(b0[0] != b[0] || b0[1] != b[1]){
-            boundary.add_item(b);
+            add_traced(boundary, b, visited, visited_first_row);
             search_clockwise(c, b, &c, &b, boundary_color); // use same c and b as input and output ( see search clockwise docs )
         }
     }
     return boundary;
 }
 
+inline boundary boundary_extractor::moore_algorithm_table(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                                                          frame_arena* arena, bool keep_walk) {
+    boundary boundary(storage_, max_length_, arena, keep_walk); // points are released when it goes over max length
+    const int step = (int)image_.step;
+
+    // Offset in the padded buffer of each clock index respect to the center b
+    int offsets[8];
+    for(int i = 0; i < 8; ++i){
+        offsets[i] = CLOCK_DY[i]*step + CLOCK_DX[i];
+    }
+
+    cv::Vec2i b(x,y); // b starts from b0
+    const uchar* b_ptr = image_.data + y*step + x;
+    int index = 7; // clock index of c0 (x-1,y) respect to b0
+
+    add_traced(boundary, b, visited, visited_first_row);
+    while(true){
+        // Search in clockwise order starting from the clock index after c, c itself is the last one checked
+        int k = 0;
+        do{
+            index = (index+1) & 7;
+            ++k;
+        }while(b_ptr[offsets[index]] != boundary_color && k < 8);
+        if(b_ptr[offsets[index]] != boundary_color)break; // single point, impossible to find next border item
+
+        b_ptr += offsets[index];
+        b[0] += CLOCK_DX[index];
+        b[1] += CLOCK_DY[index];
+        index = NEXT_C_INDEX[index];
+
+        if(b[0] == x && b[1] == y)break; // back to b0
+        add_traced(boundary, b, visited, visited_first_row);
+    }
+    return boundary;
+}
+
 
 inline bool boundary_extractor::search_clockwise(cv::Vec2i& current_c, cv::Vec2i& current_b, cv::Vec2i* c_ptr, cv::Vec2i* b_ptr, const uchar boundary_color) {
     cv::Vec2i& c = *c_ptr;
@@ -252,7 +455,8 @@ inline int boundary_extractor::find_clock_index(cv::Vec2i* c_ptr, cv::Vec2i* b_p
 }
 
 void boundary_extractor::create_boundaries_image(cv::Mat& image) {
-    image = cv::Mat::zeros(image_.rows, image_.cols, CV_8UC1); // image is larger of 1 px respect to input
+    image.create(image_.rows, image_.cols, CV_8UC1); // image is larger of 1 px respect to input ( reused if possible )
+    image.setTo(0);
 
     for(boundary& b : boundaries_){
         draw_boundary(image,b,true); // it draws each boundary
@@ -278,7 +482,7 @@ void boundary_extractor::draw_boundaries_corners(cv::Mat& image){
 }
 
 inline void boundary_extractor::draw_boundary(const cv::Mat& image, const boundary &b, vector<cv::Mat>& channels) {
-    for(cv::Vec2i v : b.points){
+    for(const cv::Vec2i& v : b){
         int j = v[0];
         int i = v[1];
         // it draws only if boundary inside image content
@@ -322,7 +526,7 @@ inline void boundary_extractor::draw_boundary(cv::Mat& image, const boundary &b,
     const int padding_offeset = (padding)? 1 : 0;
     assert((image.channels() == 1 || image.channels() == 3) && "Invalid channel number");
     if(image.channels()==1) {
-        for (cv::Vec2i v : b.points) {
+        for (const cv::Vec2i& v : b) {
             int x = v[0] + padding_offeset;// +padding_offset is in order to add padding in image
             int y = v[1] + padding_offeset;
             if(x >= 0 && y>=0 && x < image.cols && y < image.rows ) {
@@ -330,7 +534,7 @@ inline void boundary_extractor::draw_boundary(cv::Mat& image, const boundary &b,
             }
         }
     }else{
-        for (cv::Vec2i v : b.points) {
+        for (const cv::Vec2i& v : b) {
 
             int x = v[0] + padding_offeset;// +padding_offset is in order to add padding in image
             int y = v[1] + padding_offeset;
@@ -353,16 +557,15 @@ void boundary_extractor::print_boundary_lengths() {
 }
 
 void boundary_extractor::keep_between(int min_length, int max_length) {
-    // It iterates into inverse order to avoid index problem after removing element that isn't in the interval given
-    for(int i=(int)boundaries_.size()-1; i >=0 ;--i){
-        if(boundaries_[i].length < min_length || boundaries_[i].length > max_length)boundaries_.erase(boundaries_.begin()+i);
-    }
+    keep_if([min_length, max_length](const boundary& b){
+        return b.length >= min_length && b.length <= max_length;
+    });
 }
 
 void boundary_extractor::keep_between_corners(int min_corners, int max_corners){
-    for(int i=(int)boundaries_.size()-1; i >=0 ;--i){
-        if(boundaries_[i].corners_number < min_corners || boundaries_[i].corners_number > max_corners)boundaries_.erase(boundaries_.begin()+i);
-    }
+    keep_if([min_corners, max_corners](const boundary& b){
+        return b.corners_number >= min_corners && b.corners_number <= max_corners;
+    });
 }
 
 void boundary_extractor::compute_corners(cv::Mat& img_corners){
@@ -371,49 +574,41 @@ void boundary_extractor::compute_corners(cv::Mat& img_corners){
     }
 }
 
-void boundary_extractor::corners_to_matrix(cv::Mat& corner_matrix){
-    //it creates a vector of pointers to corners ( pointers have been used to avoid multiple copies )
-    std::vector<cv::Vec2i*> all_corners;
+void boundary_extractor::compute_corners_roi(const cv::Mat& boundaries_img, int block_size, int kernel_size, float free_parameter){
+    // Pixels of the bounding box need Sobel and block neighbours, Sobel reads them from boundaries_img outside the roi
+    // while the block sum is complete only farther than block_size/2 from roi border
+    const int margin = block_size/2 + kernel_size/2;
+    const cv::Rect image_rect(0, 0, boundaries_img.cols, boundaries_img.rows);
     for(boundary& b : boundaries_){
-        for(cv::Vec2i& v : b.corners){
-            all_corners.push_back(&v);
-        }
+        // Bounding box is in padded coordinates like boundaries_img
+        cv::Rect roi(b.min_x - margin, b.min_y - margin, b.max_x - b.min_x + 1 + 2*margin, b.max_y - b.min_y + 1 + 2*margin);
+        roi &= image_rect;
+        cv::cornerHarris(boundaries_img(roi), corners_roi_, block_size, kernel_size, free_parameter, cv::BorderTypes::BORDER_DEFAULT);
+        b.compute_corners(corners_roi_, roi.tl());
     }
-    // Now all_corners contains all corners of all boundaries so it converts into matrix
-    internal_corners_to_matrix(corner_matrix, all_corners);
 }
 
-void boundary_extractor::matrix_to_corners(const cv::Mat &corner_matrix){
-    int y = 0;
-    const float* p;
+void boundary_extractor::compute_corners_polygon(float epsilon_ratio){
     for(boundary& b : boundaries_){
-        for(cv::Vec2i& v : b.corners){
-            p = corner_matrix.ptr<float>(y);
-            // Use round to obtain better corners respect to truncate
-            v[0] = (int)roundf(p[0]);
-            v[1] = (int)roundf(p[1]);
-            ++y;
-        }
+        b.compute_corners_polygon(epsilon_ratio*b.length);
     }
 }
 
-inline void boundary_extractor::normalize() {
-    // it normalizes all points removing padding offset
+std::vector<cv::Point2f>& boundary_extractor::collect_corners(){
+    corner_points_.clear(); // capacity is kept between frames
     for(boundary& b : boundaries_){
-        for(cv::Vec2i& v : b.points){
-            v[0] = v[0]-1;
-            v[1] = v[1]-1;
+        b.first_corner = (int)corner_points_.size();
+        for(const cv::Vec2i& v : b.corners){
+            corner_points_.push_back(cv::Point2f((float)v[0], (float)v[1]));
         }
     }
+    return corner_points_;
 }
 
-void boundary_extractor::internal_corners_to_matrix(cv::Mat &corner_matrix, std::vector<cv::Vec2i*> &all_corners) {
-    corner_matrix = cv::Mat((int)all_corners.size(),2,CV_32FC1);
-    for(int y = 0; y < corner_matrix.rows; ++y ){
-        float* p = corner_matrix.ptr<float>(y);
-        // it copies boundaries corners value into matrix
-        p[0] = (float)(*(all_corners[y]))[0] ;
-        p[1] = (float)(*(all_corners[y]))[1] ;
+inline void boundary_extractor::normalize() {
+    // it normalizes all points removing padding offset
+    for(boundary& b : boundaries_){
+        b.translate(-1, -1);
     }
 }
 
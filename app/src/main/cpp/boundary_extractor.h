@@ -6,12 +6,30 @@
 #define ASSIGNMENT2_BOUNDARY_EXTRACTOR_H
 
 #include <vector>
+#include <algorithm>
+#include <memory>
 #include <opencv2/core/mat.hpp>
 #include "boundary.h"
+#include "frame_arena.h"
 #include "utils.h"
 
 namespace mcv{
 
+    /**
+     * Implementations of the neighbour search used by moore's algorithm, both of them produce the same boundaries
+     */
+    enum class tracing_kernel{
+        SWITCH, // clock index rebuilt from c and b at each step, neighbours read with cv::Mat::at ( original implementation )
+        TABLE // clock index kept as state, neighbours read with precomputed row stride offsets on the padded buffer
+    };
+
+    /**
+     * Strategies used to find boundary corners
+     */
+    enum class corner_detector{
+        HARRIS, // harris response thresholded along boundary points, it needs the image of the boundaries
+        POLYGON // Douglas-Peucker approximation of the ordered boundary points, vertices are the corners
+    };
 
     /**
      * Class that allows operations on boundaries, c and b are the common parameters used in Moore's algorithm
@@ -27,19 +45,105 @@ namespace mcv{
         */
         boundary_extractor(const cv::Mat& image_gray, bool compute_threshold = true);
 
+        /**
+        * Constructor: image must be given with set_padded_image before finding boundaries
+        */
+        boundary_extractor();
+
+        /**
+         * This function uses "padded_image" as internal image without allocations and copies, in this way the caller can
+         * threshold each frame directly into the same buffer ( e.g. otsu_thresholding_fused(gray, padded_image, 1) )
+         * and the same extractor can be reused for all frames of the same size
+         * @param padded_image: thresholded image with 1 pixel of BLACK padding outside, it must not be changed until
+         * boundaries have been found
+         */
+        void set_padded_image(const cv::Mat& padded_image);
+
         /**
          * Find all boundaries of the image
          * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
          */
         void find_boundaries(const uchar boundary_color = WHITE);
 
+        /**
+         * Same as find_boundaries but the image is split into horizontal bands of rows and boundaries which start into
+         * each band are traced concurrently, the result is the same ( also in order ) of find_boundaries
+         * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
+         * @param bands: number of bands, if it is not greater than zero cv::getNumThreads() bands are used
+         */
+        void find_boundaries_parallel(const uchar boundary_color = WHITE, int bands = 0);
+
         /**
          * Given a point with coordinate x,y find boundary starting from that point
          * @param x is the column index of image
          * @param y is the row index of the image
          * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
+         * @param visited: visited map where traced pixels are marked
+         * @param visited_first_row: row of image_ which corresponds to the first row of "visited"
+         * @param arena: if not null vectors of the boundary are allocated from it
+         * @param keep_walk: if true a boundary over max length keeps the chain codes of its walk ( see boundary::keep_walk )
+         */
+        inline boundary moore_algorithm(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                                        frame_arena* arena = nullptr, bool keep_walk = false);
+
+        /**
+         * Same as moore_algorithm but neighbours are visited through lookup tables of clock index
+         * ( see tracing_kernel::TABLE )
+         * @param x is the column index of image
+         * @param y is the row index of the image
+         * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
+         * @param visited: visited map where traced pixels are marked
+         * @param visited_first_row: row of image_ which corresponds to the first row of "visited"
+         * @param arena: if not null vectors of the boundary are allocated from it
+         * @param keep_walk: if true a boundary over max length keeps the chain codes of its walk ( see boundary::keep_walk )
+         */
+        inline boundary moore_algorithm_table(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                                              frame_arena* arena = nullptr, bool keep_walk = false);
+
+        /**
+         * Select which implementation of moore's algorithm is used by find_boundaries ( default tracing_kernel::TABLE )
+         * @param kernel: tracing implementation
+         */
+        inline void set_tracing_kernel(tracing_kernel kernel){
+            kernel_ = kernel;
+        }
+
+        /**
+         * Enable or disable arena allocation of boundaries ( disabled by default ): all vectors of the boundaries traced
+         * by a find_boundaries call are bump allocated from arenas owned by the extractor and released together by the
+         * next call, so boundaries obtained from get_boundaries must not be kept after that
+         * @param enabled: true to allocate boundaries from arenas
+         */
+        inline void set_arena_allocation(bool enabled){
+            use_arena_ = enabled;
+        }
+
+        /**
+         * @return bytes allocated from arenas since the last find_boundaries call ( boundaries and corners of the
+         * current frame ), 0 if arena allocation is disabled
+         */
+        size_t get_arena_bytes_used() const;
+
+        /**
+         * Set the length window of the boundaries kept by find_boundaries ( as keep_between but applied while tracing ):
+         * a boundary longer than "max_length" stops storing its points as soon as it goes over the limit, it is still
+         * walked to the end to mark its pixels as visited, and rejected boundaries are never added
+         * @param min_length lower bound (included), 0 means no limit
+         * @param max_length upper bound (included), 0 means no limit
+         */
+        inline void set_length_limits(int min_length, int max_length){
+            min_length_ = min_length;
+            max_length_ = max_length;
+        }
+
+        /**
+         * Select how points of the boundaries traced by find_boundaries are stored ( POINTS by default ), CHAIN_CODE
+         * uses 3 bits for each point instead of a cv::Vec2i
+         * @param storage: storage of boundary points
          */
-        inline boundary moore_algorithm(int x, int y, const uchar boundary_color);
+        inline void set_boundary_storage(boundary_storage storage){
+            storage_ = storage;
+        }
 
         /**
          * This function creates a new binary image where pixel is WHITE (255) if it is in a boundary BLACK (0) otherwise
@@ -74,6 +178,19 @@ namespace mcv{
          */
         void keep_between_corners(int min_corners, int max_corners);
 
+        /**
+         * This function keeps only boundaries for which "keep" returns true, in a single pass and preserving their order
+         * ( kept boundaries are moved, not copied ), conditions on length, corners and bounding box can be combined
+         * into the same predicate
+         * @param keep: predicate called with a const reference to each boundary
+         */
+        template<typename Predicate>
+        void keep_if(Predicate keep){
+            boundaries_.erase(std::remove_if(boundaries_.begin(), boundaries_.end(),
+                                             [&keep](const boundary& b){ return !keep(b); }),
+                              boundaries_.end());
+        }
+
         /**
          * Compute boundary corners starting from an image obtained from harris corner "img_corners"
          * @param img_corners: images with harris corners
@@ -81,21 +198,38 @@ namespace mcv{
         void compute_corners(cv::Mat& img_corners);
 
         /**
-         * This function converts internal boundary corners representation in cv::Mat format and it stores this result in
-         * the "corner_matrix" (WARNING corners are stored in order of boundaries)
-         * between this function and "matrix_to_corners" function no boundary filters can be applied
-         * @param corner_matrix: matrix where corners will be saved
-         * @see matrix_to_corners
+         * Compute boundary corners evaluating harris response ( cv::cornerHarris ) only inside the bounding box of each
+         * boundary instead of the whole frame, response at boundary pixels is the same of the full frame version
+         * because each bounding box is enlarged by the radius of harris kernels
+         * @param boundaries_img: image obtained from create_boundaries_image
+         * @param block_size: neighborhood size of cv::cornerHarris
+         * @param kernel_size: aperture of Sobel operator of cv::cornerHarris
+         * @param free_parameter: harris detector free parameter
          */
-        void corners_to_matrix(cv::Mat& corner_matrix);
+        void compute_corners_roi(const cv::Mat& boundaries_img, int block_size, int kernel_size, float free_parameter);
 
         /**
-         * This function performs the inverse operation respect to "corners_to_matrix" function and it updates boundary corners
-         * between "corners_to_matrix" function and this function no boundaries filters can be applied
-         * @param corner_matrix: improved corner matrix which will be used to update boundaries corners
-         * @see corners_to_matrix
+         * Compute boundary corners approximating each boundary with a polygon ( see boundary::compute_corners_polygon ),
+         * no image is needed
+         * @param epsilon_ratio: max distance between boundary and polygon as a fraction of boundary length
          */
-        void matrix_to_corners(const cv::Mat& corner_matrix);
+        void compute_corners_polygon(float epsilon_ratio);
+
+        /**
+         * Copy corners of all boundaries into the float corner store ( in order of boundaries ), each boundary keeps the
+         * index of its first corner into boundary::first_corner
+         * between this function and the use of the store no boundary filters can be applied
+         * @return corner store, contiguous x,y float pairs that can be refined in place ( e.g. with cv::cornerSubPix )
+         */
+        std::vector<cv::Point2f>& collect_corners();
+
+        /**
+         * @return float corner store filled by collect_corners, corners of boundary "b" are
+         * [b.first_corner, b.first_corner + b.corners_number)
+         */
+        inline const std::vector<cv::Point2f>& get_corner_points() const {
+            return corner_points_;
+        }
 
         /**
          * This function returns all boundaries which haven't been throw away
@@ -111,15 +245,62 @@ namespace mcv{
         void print_boundary_lengths();
 
     private:
+        /**
+         * Starting point found during the scan of a band, boundary_index is the index of the boundary traced from it
+         * into the band boundaries or -1 if it was skipped because already part of a boundary of the band
+         */
+        struct band_candidate{
+            int x;
+            int y;
+            int boundary_index;
+        };
+
         // Name of the target image
         const std::string filename_;
         // Image thresholded with 1 pixel of padding outside
         cv::Mat image_;
+        // Map with the same size of image_ where pixels already traced by moore's algorithm are different from zero
+        cv::Mat visited_;
+        cv::Mat corners_roi_; // harris response of a single bounding box, reused between boundaries
+        // Arenas of the boundaries of the current frame, one for each band of find_boundaries_parallel
+        // ( declared before boundaries_ because boundaries must be destroyed first )
+        bool use_arena_ = false;
+        frame_arena arena_;
+        std::vector<std::unique_ptr<frame_arena>> band_arenas_;
+        // Visited maps and candidates of the bands of find_boundaries_parallel, reused between frames
+        std::vector<cv::Mat> band_visited_;
+        std::vector<std::vector<band_candidate>> band_candidates_;
         // Vector of all boundaries of the image ( full after calling find_boundaries )
         std::vector<boundary> boundaries_;
+        // Float corners of all boundaries, kept with subpixel precision ( see collect_corners )
+        std::vector<cv::Point2f> corner_points_;
+        // Implementation of moore's algorithm used by find_boundaries
+        tracing_kernel kernel_ = tracing_kernel::TABLE;
+        // Storage of the points of traced boundaries
+        boundary_storage storage_ = boundary_storage::POINTS;
+        // Length window of the boundaries kept by find_boundaries ( 0 means no limit )
+        int min_length_ = 0;
+        int max_length_ = 0;
+
+        /**
+         * @return true if "b" is inside the length window set with set_length_limits
+         */
+        inline bool is_accepted(const boundary& b);
+
+        /**
+         * Release all boundaries and reset arenas for a new frame
+         */
+        inline void clear_boundaries();
 
         /**
-         * Internal function which checks position (x,y) is a valid initial boundary point not already found
+         * Clear visited_ reusing its buffer when image_ size doesn't change
+         */
+        inline void reset_visited();
+
+        /**
+         * Internal function which checks position (x,y) is a valid initial boundary point not already found, this is
+         * used to avoid multiple boundaries with different starting point but the same sequence.
+         * The check is a single lookup into visited_ so it doesn't depend on the number of boundaries already found
          * @param x column index in image_
          * @param y row index in image_
          * @return true if that point is the starting point for a new boundary
@@ -127,14 +308,53 @@ namespace mcv{
         inline bool is_valid(int x, int y);
 
         /**
-         * Check if point (x,y) is already present into a boundary given as param, this is used to avoid multiple
-         * boundaries with different starting point but the same sequence
-         * @param b: boundary where search (x,y)
-         * @param x
-         * @param y
-         * @return true if (x,y) is present into bounddary b
+         * Scan rows between first_row (included) and last_row (excluded) searching for starting points of boundaries
+         * and trace all valid ones
+         * @param first_row: first row of image_ to scan
+         * @param last_row: row of image_ where scan stops (excluded)
+         * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
+         * @param visited: visited map used to validate starting points, it must contain rows between first_row and last_row
+         * @param visited_first_row: row of image_ which corresponds to the first row of "visited"
+         * @param boundaries: vector where traced boundaries are added
+         * @param candidates: if not null all starting points found are added here ( also not valid ones )
+         * @param arena: arena of the traced boundaries, null to use the standard allocator
+         */
+        inline void scan_rows(int first_row, int last_row, const uchar boundary_color, cv::Mat& visited,
+                              int visited_first_row, std::vector<boundary>& boundaries,
+                              std::vector<band_candidate>* candidates, frame_arena* arena);
+
+        /**
+         * Compute the value of the flag which skips close pixels at the beginning of the given row, it is the same value
+         * that a scan started from the first row has when it reaches "row"
+         * @param row: row of image_
+         * @param boundary_color: color of the boundary ( mcv::BLACK or mcv::WHITE )
+         * @return true if the first pixel of the row with boundary_color can be a starting point
+         */
+        inline bool initial_valid_next(int row, const uchar boundary_color);
+
+        /**
+         * Trace the boundary which starts from (x,y) with the selected tracing kernel
+         * @see moore_algorithm
+         */
+        inline boundary trace(int x, int y, const uchar boundary_color, cv::Mat& visited, int visited_first_row,
+                              frame_arena* arena, bool keep_walk = false);
+
+        /**
+         * Mark point "p" as already traced into "visited", points outside of "visited" are ignored
+         * @param p: point in image_ coordinates
+         * @param visited: visited map
+         * @param visited_first_row: row of image_ which corresponds to the first row of "visited"
+         */
+        inline void mark_visited(const cv::Vec2i& p, cv::Mat& visited, int visited_first_row);
+
+        /**
+         * Add point "p" to boundary "b" and mark it as already traced into "visited"
+         * @param b: boundary where the point will be added
+         * @param p: point in image_ coordinates
+         * @param visited: visited map
+         * @param visited_first_row: row of image_ which corresponds to the first row of "visited"
          */
-        inline bool check_in(const boundary& b, int x, int y);
+        inline void add_traced(boundary& b, cv::Vec2i& p, cv::Mat& visited, int visited_first_row);
 
         /**
          * Search in clock wise order a new c and b starting from current_c current_b, current_b is the center
@@ -189,14 +409,6 @@ namespace mcv{
          * This function removes offset of padding image for all boundary points of each boundary
          */
         inline void normalize();
-
-        /**
-         * This function performs the raw operation of conversion between boundaries corners and cv::Mat and it inits the
-         * destination matrix "corner_matrix"
-         * @param corner_matrix: matrix where results are stored
-         * @param all_corners: vector of pointers where all corners of all boundaries have been putted together
-         */
-        inline void internal_corners_to_matrix(cv::Mat& corner_matrix, std::vector<cv::Vec2i*>& all_corners);
     };
 
 }
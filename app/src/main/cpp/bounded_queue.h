@@ -0,0 +1,88 @@
+//
+// Fixed capacity lock-free queue used to pass frames between threads
+//
+
+#ifndef PICTUREAR_BOUNDED_QUEUE_H
+#define PICTUREAR_BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace mcv{
+
+    /**
+     * Lock-free ring buffer with a fixed capacity: a single thread pushes, any number of threads pop ( e.g. a consumer
+     * and the producer itself dropping the oldest item ). Items are stored into atomics so "T" must be trivially
+     * copyable and small, typically a pointer.
+     */
+    template<typename T>
+    class bounded_queue{
+    public:
+        /**
+         * @param capacity: max number of items into the queue ( at least 1 )
+         */
+        explicit bounded_queue(size_t capacity):capacity_(capacity > 0 ? capacity : 1),
+                                                items_(new std::atomic<T>[capacity > 0 ? capacity : 1]),
+                                                head_(0), tail_(0){
+            static_assert(std::is_trivially_copyable<T>::value, "Items must be trivially copyable");
+        }
+
+        bounded_queue(const bounded_queue&) = delete;
+        bounded_queue& operator=(const bounded_queue&) = delete;
+
+        /**
+         * Append "item" to the queue ( only one thread can push )
+         * @return false if the queue is full
+         */
+        bool push(const T& item){
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if(tail - head_.load(std::memory_order_acquire) >= capacity_){
+                return false;
+            }
+            items_[tail % capacity_].store(item, std::memory_order_relaxed);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Remove the oldest item of the queue ( any thread can pop )
+         * @param item: output, the removed item
+         * @return false if the queue is empty
+         */
+        bool pop(T& item){
+            size_t head = head_.load(std::memory_order_acquire);
+            while(head != tail_.load(std::memory_order_acquire)){
+                // Item is read before taking it, if another thread took it first the read value is discarded
+                item = items_[head % capacity_].load(std::memory_order_relaxed);
+                if(head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * @return number of items into the queue ( it can be already changed when it is read )
+         */
+        inline size_t size() const {
+            const size_t head = head_.load(std::memory_order_acquire);
+            const size_t tail = tail_.load(std::memory_order_acquire);
+            return tail >= head ? tail - head : 0;
+        }
+
+        inline size_t capacity() const {
+            return capacity_;
+        }
+
+    private:
+        const size_t capacity_;
+        std::unique_ptr<std::atomic<T>[]> items_;
+        std::atomic<size_t> head_; // index of the oldest item ( never wraps around in practice )
+        std::atomic<size_t> tail_; // index of the next pushed item
+    };
+}
+
+
+#endif //PICTUREAR_BOUNDED_QUEUE_H
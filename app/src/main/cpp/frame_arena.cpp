@@ -0,0 +1,74 @@
+//
+// Monotonic memory used to store boundaries of a single frame
+//
+
+#include "frame_arena.h"
+#include <algorithm>
+#include <stdint.h>
+
+mcv::frame_arena::frame_arena(size_t chunk_size):chunk_size_(std::max(chunk_size, (size_t)1)) {}
+
+void* mcv::frame_arena::allocate(size_t bytes, size_t alignment) {
+    if(chunks_.empty()){
+        next_chunk(bytes + alignment);
+    }
+    uintptr_t base = (uintptr_t)chunks_[current_].data.get();
+    uintptr_t p = (base + offset_ + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if(p + bytes > base + chunks_[current_].size){
+        next_chunk(bytes + alignment);
+        base = (uintptr_t)chunks_[current_].data.get();
+        p = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+    const size_t new_offset = (size_t)(p - base) + bytes;
+    used_ += new_offset - offset_;
+    offset_ = new_offset;
+    return (void*)p;
+}
+
+void mcv::frame_arena::deallocate(void* p, size_t bytes) {
+    if(chunks_.empty())return;
+    // Only the last allocation can be given back ( alignment padding before it is kept )
+    char* top = chunks_[current_].data.get() + offset_;
+    if((char*)p + bytes == top){
+        offset_ -= bytes;
+        used_ -= bytes;
+    }
+}
+
+void mcv::frame_arena::next_chunk(size_t bytes) {
+    // Chunks already allocated by previous frames are reused before allocating a new one
+    while(!chunks_.empty() && current_+1 < chunks_.size()){
+        ++current_;
+        offset_ = 0;
+        if(chunks_[current_].size >= bytes)return;
+    }
+    chunk c;
+    c.size = std::max(bytes, chunks_.empty()? chunk_size_ : chunks_.back().size*2); // geometric growth
+    c.data.reset(new char[c.size]);
+    chunks_.push_back(std::move(c));
+    current_ = chunks_.size()-1;
+    offset_ = 0;
+}
+
+void mcv::frame_arena::reset() {
+    if(chunks_.size() > 1){
+        // Replace all chunks with a single one, next frame of the same size will fit without allocations
+        const size_t total = bytes_reserved();
+        chunks_.clear();
+        chunk c;
+        c.size = total;
+        c.data.reset(new char[c.size]);
+        chunks_.push_back(std::move(c));
+    }
+    current_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
+
+size_t mcv::frame_arena::bytes_reserved() const {
+    size_t total = 0;
+    for(const chunk& c : chunks_){
+        total += c.size;
+    }
+    return total;
+}
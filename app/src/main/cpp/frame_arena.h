@@ -0,0 +1,138 @@
+//
+// Monotonic memory used to store boundaries of a single frame
+//
+
+#ifndef PICTUREAR_FRAME_ARENA_H
+#define PICTUREAR_FRAME_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+namespace mcv{
+
+    /**
+     * Monotonic buffer: memory is bump allocated from large chunks and it is released all together with reset(), after
+     * the first frames chunks are large enough and no more allocation is done.
+     * It isn't thread safe, each thread must use its own arena.
+     */
+    class frame_arena{
+    public:
+        /**
+         * @param chunk_size: size in bytes of the first chunk
+         */
+        explicit frame_arena(size_t chunk_size = 64*1024);
+
+        frame_arena(const frame_arena&) = delete;
+        frame_arena& operator=(const frame_arena&) = delete;
+
+        /**
+         * Allocate "bytes" aligned to "alignment" ( power of 2 )
+         */
+        void* allocate(size_t bytes, size_t alignment);
+
+        /**
+         * Memory is released only by reset, but if "p" is the last allocation it is given back immediately. A growing
+         * vector allocates its new block before releasing the old one, so old blocks stay stranded until reset ( with
+         * geometric growth they add up to about the final size of the vector )
+         */
+        void deallocate(void* p, size_t bytes);
+
+        /**
+         * Release all allocations, chunks are merged into a single one large enough for the whole last frame
+         * ( WARNING all memory allocated from the arena is invalid after this call )
+         */
+        void reset();
+
+        /**
+         * @return bytes allocated since last reset ( alignment padding included )
+         */
+        inline size_t bytes_used() const {
+            return used_;
+        }
+
+        /**
+         * @return bytes owned by the arena
+         */
+        size_t bytes_reserved() const;
+
+    private:
+        struct chunk{
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        std::vector<chunk> chunks_;
+        size_t chunk_size_;
+        size_t current_ = 0; // chunk used by allocations
+        size_t offset_ = 0; // first free byte of current chunk
+        size_t used_ = 0;
+
+        /**
+         * Move to a chunk with at least "bytes" free bytes, a new chunk is allocated if needed
+         */
+        void next_chunk(size_t bytes);
+    };
+
+    /**
+     * C++11 allocator which takes memory from a frame_arena, without arena it uses the standard allocator so default
+     * constructed containers work as usual
+     */
+    template<typename T>
+    class arena_allocator{
+    public:
+        typedef T value_type;
+        // Containers moved or swapped take the arena with them
+        typedef std::true_type propagate_on_container_copy_assignment;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        template<typename U>
+        struct rebind{
+            typedef arena_allocator<U> other;
+        };
+
+        arena_allocator():arena_(nullptr){}
+
+        explicit arena_allocator(frame_arena* arena):arena_(arena){}
+
+        template<typename U>
+        arena_allocator(const arena_allocator<U>& other):arena_(other.arena()){}
+
+        T* allocate(size_t n){
+            if(arena_ == nullptr){
+                return std::allocator<T>().allocate(n);
+            }
+            return static_cast<T*>(arena_->allocate(n*sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* p, size_t n){
+            if(arena_ == nullptr){
+                std::allocator<T>().deallocate(p, n);
+                return;
+            }
+            arena_->deallocate(p, n*sizeof(T));
+        }
+
+        inline frame_arena* arena() const {
+            return arena_;
+        }
+
+    private:
+        frame_arena* arena_;
+    };
+
+    template<typename T, typename U>
+    inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b){
+        return a.arena() == b.arena();
+    }
+
+    template<typename T, typename U>
+    inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b){
+        return a.arena() != b.arena();
+    }
+}
+
+
+#endif //PICTUREAR_FRAME_ARENA_H
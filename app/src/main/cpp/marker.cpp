@@ -6,13 +6,86 @@
 #include "utils.h"
 #include "boundary_extractor.h"
 #include "Matcher.h"
+#include "ARPipeline.h"
 #include <assert.h>
 #include <opencv2/highgui.hpp>
 #include <opencv2/core/utility.hpp>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Number of bits set into "v", builtin uses hardware popcount when target supports it
+ */
+static inline int popcount64(uint64_t v){
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(v);
+#else
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Number of BLACK pixels strictly inside the orientation rectangle of "rotation_degree" and inside the marker border,
+ * pixels are counted directly on the rows of the rectangle
+ */
+static int count_black(const cv::Mat& warped_image, int rotation_degree){
+    using namespace mcv::marker;
+    cv::Point top_left, bottom_right;
+    orientation_rect(rotation_degree, warped_image.cols, top_left, bottom_right);
+    const int offset = canvas_scale(OFFSET, warped_image.cols);
+    const int x_begin = std::max(top_left.x+1, offset);
+    const int x_end = std::min(bottom_right.x, warped_image.cols-offset); // excluded
+    const int y_begin = std::max(top_left.y+1, offset);
+    const int y_end = std::min(bottom_right.y, warped_image.rows-offset); // excluded
+    int count = 0;
+    for(int y = y_begin; y < y_end; ++y){
+        const uchar* p = warped_image.ptr<uchar>(y);
+        for(int x = x_begin; x < x_end; ++x){
+            count += (p[x] == mcv::BLACK);
+        }
+    }
+    return count;
+}
+
+void mcv::marker::orientation_rect(int rotation_degree, int canvas_size, cv::Point& top_left, cv::Point& bottom_right) {
+    const int offset = canvas_scale(OFFSET, canvas_size);
+    const int width = canvas_scale(WIDTH, canvas_size);
+    const int height = canvas_scale(HEIGHT, canvas_size);
+    switch(rotation_degree){
+        case 0:
+            top_left = cv::Point(canvas_size-(offset+width), canvas_size-(offset+height));
+            bottom_right = cv::Point(canvas_size-offset, canvas_size-offset);
+            break;
+        case 90:
+            top_left = cv::Point(canvas_size-(offset+height), offset);
+            bottom_right = cv::Point(canvas_size-offset, offset+width);
+            break;
+        case 180:
+            top_left = cv::Point(offset, offset);
+            bottom_right = cv::Point(offset+width, offset+height);
+            break;
+        case 270:
+            top_left = cv::Point(offset, canvas_size-(offset+width));
+            bottom_right = cv::Point(offset+height, canvas_size-offset);
+            break;
+        default:
+            throw std::invalid_argument("only 0,90,180,270 degree are supported");
+    }
+}
 
 int mcv::marker::detect_orientation(const cv::Mat& warped_image) {
+    return detect_orientation(warped_image, nullptr);
+}
+
+int mcv::marker::detect_orientation(const cv::Mat& warped_image, float* confidence) {
 
     int res = 0;
     int max = -1;
@@ -21,30 +94,15 @@ int mcv::marker::detect_orientation(const cv::Mat& warped_image) {
      * accumutators[1] = 90 degree accumulator
      * accumutators[2] = 180 degree accumulator
      * accumutators[3] = 270 degree accumulator
+     * Only the four rectangles are read instead of testing each pixel of the inner area against all of them
+     * ( rectangles are scaled to the canvas size )
      */
-    int accumulators[] = {0, 0, 0, 0};
-    int y,x;
-    const uchar* p;
-    for( y = OFFSET; y < warped_image.rows-OFFSET; ++y) {
-        p = warped_image.ptr<uchar>(y);
-        for ( x = OFFSET; x < warped_image.cols-OFFSET; ++x) {
-            // If pixel black adds it into accumulator of correct region
-            if(p[x] == BLACK){
-                if(x > RECT_0[0].x && x < RECT_0[1].x && y > RECT_0[0].y && y < RECT_0[1].y){
-                    ++(accumulators[0]);
-                }
-                if(x > RECT_90[0].x && x < RECT_90[1].x && y > RECT_90[0].y && y < RECT_90[1].y){
-                    ++(accumulators[1]);
-                }
-                if(x > RECT_180[0].x && x < RECT_180[1].x && y > RECT_180[0].y && y < RECT_180[1].y){
-                    ++(accumulators[2]);
-                }
-                if(x > RECT_270[0].x && x < RECT_270[1].x && y > RECT_270[0].y && y < RECT_270[1].y){
-                    ++(accumulators[3]);
-                }
-            }
-        }
-    }
+    const int accumulators[] = {
+            count_black(warped_image, 0),
+            count_black(warped_image, 90),
+            count_black(warped_image, 180),
+            count_black(warped_image, 270)
+    };
 
     // Find orientation considering accumulator with higher value.
     for(int i=0; i<4; ++i){
@@ -53,31 +111,46 @@ int mcv::marker::detect_orientation(const cv::Mat& warped_image) {
             res = 90*i;
         }
     }
+
+    if(confidence != nullptr){
+        // Margin between best and second best accumulator respect to the area of a rectangle
+        int second = -1;
+        for(int i=0; i<4; ++i){
+            if(90*i != res && accumulators[i] > second){
+                second = accumulators[i];
+            }
+        }
+        const int width = canvas_scale(WIDTH, warped_image.cols);
+        const int height = canvas_scale(HEIGHT, warped_image.cols);
+        const float area = (float)((width-1)*(height-1)); // pixels strictly inside a rectangle
+        *confidence = (float)(max-second)/area;
+    }
     return res;
 }
 
-void mcv::marker::calculate_rotation_matrix(cv::Mat& rotation_matrix, int rotation_degree, const bool rotation_update){
+void mcv::marker::calculate_rotation_matrix(cv::Mat& rotation_matrix, int rotation_degree, const bool rotation_update, int canvas_size){
     float radiants = 0.0f;
     float offset_x = 0.0f;
     float offset_y = 0.0f;
     // Convert orientation into radiants and it computes offset necessary to have rotation respect to center
+    // ( offsets are the size of the canvas, the same of rotation_coefficients )
     switch(rotation_degree){
         case 0:
             break;
         case 90:
             radiants = (float)(CV_PI/2.0);
-            offset_x = 256.0f;
+            offset_x = (float)canvas_size;
             offset_y = 0.0f;
             break;
         case 180:
             radiants = (float)CV_PI;
-            offset_x = 256.0f;
-            offset_y = 256.0f;
+            offset_x = (float)canvas_size;
+            offset_y = (float)canvas_size;
             break;
         case 270:
             radiants = (float)((3.0f/2.0f)*CV_PI);
             offset_x = 0.0f;
-            offset_y = 256.0f;
+            offset_y = (float)canvas_size;
             break;
         default:
             throw std::invalid_argument("only 0,90,180,270 degree are supported");
@@ -104,19 +177,105 @@ void mcv::marker::calculate_rotation_matrix(cv::Mat& rotation_matrix, int rotati
     }
 }
 
-void mcv::marker::calculate_picture_rotation(cv::Mat &rotation_matrix, int rotation_degree) {
+/**
+ * Integer coefficients of the matrix created by calculate_rotation_matrix for a canvas of "canvas_size" pixels:
+ * x' = cos*x - sin*y + offset_x
+ * y' = sin*x + cos*y + offset_y
+ */
+static void rotation_coefficients(int rotation_degree, int canvas_size, int& cos_r, int& sin_r, int& offset_x, int& offset_y){
+    switch(rotation_degree){
+        case 0:
+            cos_r = 1; sin_r = 0; offset_x = 0; offset_y = 0;
+            break;
+        case 90:
+            cos_r = 0; sin_r = 1; offset_x = canvas_size; offset_y = 0;
+            break;
+        case 180:
+            cos_r = -1; sin_r = 0; offset_x = canvas_size; offset_y = canvas_size;
+            break;
+        case 270:
+            cos_r = 0; sin_r = -1; offset_x = 0; offset_y = canvas_size;
+            break;
+        default:
+            throw std::invalid_argument("only 0,90,180,270 degree are supported");
+    }
+}
+
+void mcv::marker::rotate_canvas(const cv::Mat& warped_image, cv::Mat& rotated_image, int rotation_degree) {
+    assert(warped_image.data != rotated_image.data && "In place rotation is not supported");
+    assert(warped_image.rows == warped_image.cols && "Canvas must be square");
+    int cos_r, sin_r, offset_x, offset_y;
+    rotation_coefficients(rotation_degree, warped_image.cols, cos_r, sin_r, offset_x, offset_y);
+    rotated_image.create(warped_image.rows, warped_image.cols, warped_image.type()); // reused if possible
+
+    // Each destination pixel (x,y) reads the source pixel at inverse rotation of (x,y):
+    // sx = cos*(x-offset_x) + sin*(y-offset_y), sy = -sin*(x-offset_x) + cos*(y-offset_y)
+    // coordinates out of the image ( one row or column for 90,180,270 ) are reflected as BORDER_DEFAULT does
+    for(int y = 0; y < rotated_image.rows; ++y){
+        uchar* p = rotated_image.ptr<uchar>(y);
+        for(int x = 0; x < rotated_image.cols; ++x){
+            int sx = cos_r*(x-offset_x) + sin_r*(y-offset_y);
+            int sy = -sin_r*(x-offset_x) + cos_r*(y-offset_y);
+            if((unsigned)sx >= (unsigned)warped_image.cols)sx = cv::borderInterpolate(sx, warped_image.cols, cv::BORDER_DEFAULT);
+            if((unsigned)sy >= (unsigned)warped_image.rows)sy = cv::borderInterpolate(sy, warped_image.rows, cv::BORDER_DEFAULT);
+            p[x] = warped_image.ptr<uchar>(sy)[sx];
+        }
+    }
+}
+
+void mcv::marker::rotate_homography(const cv::Mat& H, int rotation_degree, cv::Mat& H_rotated, int canvas_size) {
+    assert(H.type() == CV_64F && H.rows == 3 && H.cols == 3 && "Invalid homography");
+    int cos_r, sin_r, offset_x, offset_y;
+    rotation_coefficients(rotation_degree, canvas_size, cos_r, sin_r, offset_x, offset_y);
+    H_rotated.create(3, 3, CV_64F); // reused if possible
+
+    // Rotation * H, rotation rows only combine rows of H
+    const double* h0 = H.ptr<double>(0);
+    const double* h1 = H.ptr<double>(1);
+    const double* h2 = H.ptr<double>(2);
+    double* r0 = H_rotated.ptr<double>(0);
+    double* r1 = H_rotated.ptr<double>(1);
+    double* r2 = H_rotated.ptr<double>(2);
+    for(int i = 0; i < 3; ++i){
+        const double x = h0[i], y = h1[i], w = h2[i];
+        r0[i] = cos_r*x - sin_r*y + offset_x*w;
+        r1[i] = sin_r*x + cos_r*y + offset_y*w;
+        r2[i] = w;
+    }
+}
+
+void mcv::marker::canvas_homography(const cv::Mat& H, int canvas_size, cv::Mat& H_canvas) {
+    assert(H.type() == CV_64F && H.rows == 3 && H.cols == 3 && "Invalid homography");
+    H_canvas.create(3, 3, CV_64F); // reused if possible ( or H itself )
+
+    // Scale * H, only the first two rows are scaled
+    const double scale = (double)canvas_size/CANVAS_SIZE;
+    for(int y = 0; y < 3; ++y){
+        const double* h = H.ptr<double>(y);
+        double* c = H_canvas.ptr<double>(y);
+        for(int x = 0; x < 3; ++x){
+            c[x] = y < 2 ? scale*h[x] : h[x];
+        }
+    }
+}
+
+void mcv::marker::calculate_picture_rotation(cv::Mat &rotation_matrix, int rotation_degree, int canvas_size) {
     // For picture respect marker we need to flip if degrees are 90 0 270
     if(rotation_degree == 90 || rotation_degree == 270){
         // Calculate orientation of picture given orientation of marker
         rotation_degree = (rotation_degree+180)%360;
-        calculate_rotation_matrix(rotation_matrix, rotation_degree, true); // Update rotation matrix
+        calculate_rotation_matrix(rotation_matrix, rotation_degree, true, canvas_size); // Update rotation matrix
     }
 }
 
-float mcv::marker::compute_matching(const cv::Mat &marker_extracted, const cv::Mat &marker_candidate, const cv::Point top_left, const cv::Point bottom_right) {
+float mcv::marker::compute_matching(const cv::Mat &marker_extracted, const cv::Mat &marker_candidate, const cv::Point top_left, cv::Point bottom_right) {
 
     assert(marker_extracted.rows == marker_candidate.rows && marker_extracted.cols == marker_candidate.cols && "Dimensions mismatch");
 
+    if(bottom_right.x < 0 || bottom_right.y < 0){
+        bottom_right = cv::Point(marker_extracted.cols, marker_extracted.rows); // whole image, any canvas size
+    }
+
     float sum = 0.0f;
     float max = (bottom_right.x-top_left.x)*(bottom_right.y-top_left.y);
 
@@ -136,116 +295,134 @@ float mcv::marker::compute_matching(const cv::Mat &marker_extracted, const cv::M
     return sum/max;
 }
 
-void mcv::marker::apply_AR(const mcv::Matcher& matcher, cv::Mat& camera_frame, bool debug_info) {
-    cv::Mat frame_debug;
-    cv::Mat grayscale;
-    cv::Mat frame_th;
-    cv::Mat boundaries_img; // 1px larger than camera_frame
-    cv::Mat corner_matrix; // matrix which represents all corners survived to filtering
-
-    ///=== STEP 1 ===
-    // Convert original image into gray scale image
-    cv::cvtColor(camera_frame, grayscale, cv::COLOR_RGB2GRAY);
-
-    if(debug_info) {
-        frame_debug = camera_frame.clone();
-    }
-
-    ///=== STEP 2 ===
-    //Calculate threshold image from the gray scale
-    mcv::image_otsu_thresholding(grayscale, frame_th);
-
-    ///=== STEP 3 ===
-    // Boundary extraction
-    mcv::boundary_extractor be(frame_th, false);
-    be.find_boundaries(mcv::BLACK);
-
-    ///=== STEP 4 ===
-    be.keep_between(BOUNDARY_MIN_LENGTH, BOUNDARY_MAX_LENGTH);
-
-    ///=== STEP 5 ===
-    be.create_boundaries_image(boundaries_img);// 1 pixel of padding
-
-    ///=== STEP 6 ===
-    //===detect corners of the boundaries with harris corner (WARNING both images have 1px of padding respect to the original one )
-    cv::Mat img_corners = cv::Mat::zeros(boundaries_img.rows, boundaries_img.cols, CV_32FC1); // float values
-    int block_size = 11;
-    int kernel_size = 7;
-    float free_parameter = 0.05f; // more little more corners will be found
-    cv::cornerHarris(boundaries_img, img_corners, block_size, kernel_size, free_parameter, cv::BorderTypes::BORDER_DEFAULT);
-
-    ///=== STEP 7 ===
-    //search corners in img_corners
-    be.compute_corners(img_corners);
-    ///=== STEP 8 ===
-    be.keep_between_corners(4, 4);
-
-    ///=== STEP 9 ===
-    be.corners_to_matrix(corner_matrix);
-    const cv::TermCriteria criteria = cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 100, 0.001);
-    // cornerSubPix optimization is based on original thresholded image
-    cv::cornerSubPix(frame_th,corner_matrix,cv::Size(5,5),cv::Size(-1,-1),criteria); // (-1,-1) means no zero zone
-    be.matrix_to_corners(corner_matrix);
-
-    //========== HOMOGRAPHY =============
-    // All homography operation are applied into unblured image
-    // warp has been computed in inverse_map configuration to avoid white hole when picture where reported to original one
-    std::vector<mcv::boundary> &boundaries = be.get_boundaries();
-    for (mcv::boundary &boundary : boundaries) {
-        cv::Mat warped_img;
-        cv::Mat rotation_matrix; // This matrix will be used to find rotation of placeholders and images
-
-
-
-        ///=== STEP 10 ===
-        // find Homography
-        std::vector<cv::Vec2d> corners;
-        for (cv::Vec2i &corner : boundary.corners) {
-            corners.push_back(cv::Vec2d(corner[0], corner[1]));
+float mcv::marker::compute_matching_bounded(const cv::Mat &marker_extracted, const cv::Mat &marker_candidate, float bound, int* skipped_rows) {
+
+    assert(marker_extracted.rows == marker_candidate.rows && marker_extracted.cols == marker_candidate.cols && "Dimensions mismatch");
+
+    const int nRows = marker_extracted.rows;
+    const int nCols = marker_extracted.cols;
+    // Scores are compared multiplied by 255*pixels so everything is integer until the end
+    const double max = 255.0*nRows*nCols;
+    const double target = (double)bound*max;
+    long long sum = 0;
+
+    const uchar *p_marker_extracted;
+    const uchar *p_marker_candidate;
+    for(int y = 0; y < nRows; ++y) {
+        p_marker_extracted = marker_extracted.ptr<uchar>(y);
+        p_marker_candidate = marker_candidate.ptr<uchar>(y);
+        int row_sum = 0;
+        for (int x = 0; x < nCols; ++x) {
+            row_sum += 255 - abs(p_marker_extracted[x]-p_marker_candidate[x]);
         }
-        cv::Mat H = cv::findHomography(corners, mcv::marker::DST_POINTS);
-        // Use bilinear interpolation here to obtain better warping where compute matching
-        cv::warpPerspective(frame_th, warped_img, H, cv::Size(256, 256), cv::INTER_LINEAR, cv::BORDER_DEFAULT);
-        ///=== STEP 11 ===
-        // Detect orientation
-        int orientation = mcv::marker::detect_orientation(warped_img);
-
-        ///=== STEP 12 ===
-        // Calculate rotation matrixes ( and create it )
-        mcv::marker::calculate_rotation_matrix(rotation_matrix, orientation);
-        cv::warpPerspective(warped_img, warped_img, rotation_matrix.inv(), cv::Size(256, 256), cv::WARP_INVERSE_MAP, cv::BORDER_DEFAULT);
-
-        ///=== STEP 13 ===
-        // ============ MATCHING
-
-        const cv::Mat* matched_image = matcher.findBestMatch(warped_img, MATCH_THRESHOLD);
-        if(matched_image != nullptr){
-
-            cv::Mat output_img;
-
-            // Updated rotation matrix with picture rotation
-            mcv::marker::calculate_picture_rotation(rotation_matrix, orientation);
-            cv::warpPerspective(*matched_image, output_img, rotation_matrix, cv::Size(256, 256));
-            cv::warpPerspective(output_img, camera_frame, H, cv::Size(camera_frame.cols, camera_frame.rows), cv::WARP_INVERSE_MAP, cv::BORDER_TRANSPARENT);
+        sum += row_sum;
+
+        // Best case: all remaining pixels are equal
+        const double upper = (double)sum + 255.0*(double)(nRows-1-y)*nCols;
+        if(upper < target){
+            if(skipped_rows != nullptr)*skipped_rows += nRows-1-y;
+            return (float)(upper/max);
         }
+    }
+
+    // Normalize sum in order to convert into probability
+    return (float)(sum/max);
+}
 
-//        if(debug_info){
-//            cv::imshow("warped_marker", warped_img);
-////            cout << "LEO: " << match_0m << ", VAN: " << match_1m << endl;
-//        }
+void mcv::marker::pack_bits(const cv::Mat& image, uint64_t* bits) {
+    assert(image.channels() == 1 && "Invalid channel number");
+    const int words_per_row = (image.cols+63)/64;
+    for(int y = 0; y < image.rows; ++y) {
+        const uchar* p = image.ptr<uchar>(y);
+        uint64_t* row_bits = bits + y*words_per_row;
+        for(int w = 0; w < words_per_row; ++w){
+            const int x0 = w*64;
+            const int n = std::min(64, image.cols-x0);
+            uint64_t word = 0;
+            int b = 0;
+#if defined(__SSE2__)
+            // most significant bit of each byte is 1 only if pixel > 127
+            for(; b+16 <= n; b += 16){
+                uint64_t mask = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p+x0+b)));
+                word |= mask << b;
+            }
+#endif
+            for(; b < n; ++b){
+                word |= (uint64_t)(p[x0+b] > 127) << b;
+            }
+            row_bits[w] = word;
+        }
+    }
+}
 
+float mcv::marker::compute_matching_bits(const uint64_t* marker_extracted, const uint64_t* marker_candidate, int words, int pixels) {
+    int different = 0;
+    for(int i = 0; i < words; ++i){
+        different += popcount64(marker_extracted[i] ^ marker_candidate[i]);
     }
+    // Normalize number of equal pixels in order to convert into probability
+    return (float)(pixels-different)/(float)pixels;
+}
 
-    // It shows debug images with features
-//    if (debug_info) {
-//        be.draw_boundaries(frame_debug);
-//        be.draw_boundaries_corners(frame_debug);
-//
-//        cv::imshow("thresholded", frame_th);
-//        cv::imshow("corners", img_corners);
-//        cv::imshow("live", frame_debug);
-//
-//    }
+float mcv::marker::compute_matching_bits_bounded(const uint64_t* marker_extracted, const uint64_t* marker_candidate, int rows, int cols, float bound, int* skipped_rows) {
+    const int words_per_row = (cols+63)/64;
+    const int pixels = rows*cols;
+    // Max number of different pixels to stay over bound
+    const double max_different = (1.0-(double)bound)*pixels;
+    int different = 0;
+    for(int y = 0; y < rows; ++y){
+        const int begin = y*words_per_row;
+        for(int i = begin; i < begin+words_per_row; ++i){
+            different += popcount64(marker_extracted[i] ^ marker_candidate[i]);
+        }
+        // Best case: all remaining pixels are equal
+        if(different > max_different){
+            if(skipped_rows != nullptr)*skipped_rows += rows-1-y;
+            return (float)(pixels-different)/(float)pixels;
+        }
+    }
+    // Normalize number of equal pixels in order to convert into probability
+    return (float)(pixels-different)/(float)pixels;
 }
 
+void mcv::marker::compute_signature(const cv::Mat& image, uint64_t* signature) {
+    assert(image.channels() == 1 && "Invalid channel number");
+    assert(image.rows >= SIGNATURE_SIZE && image.cols >= SIGNATURE_SIZE && "Image too small for signature");
 
+    // Sum of each block column for the current band of rows
+    int block_sums[SIGNATURE_SIZE];
+    for(int w = 0; w < SIGNATURE_WORDS; ++w){
+        signature[w] = 0;
+    }
+    for(int by = 0; by < SIGNATURE_SIZE; ++by){
+        const int y_begin = (by*image.rows)/SIGNATURE_SIZE;
+        const int y_end = ((by+1)*image.rows)/SIGNATURE_SIZE;
+        for(int bx = 0; bx < SIGNATURE_SIZE; ++bx){
+            block_sums[bx] = 0;
+        }
+        for(int y = y_begin; y < y_end; ++y){
+            const uchar* p = image.ptr<uchar>(y);
+            for(int bx = 0; bx < SIGNATURE_SIZE; ++bx){
+                const int x_end = ((bx+1)*image.cols)/SIGNATURE_SIZE;
+                int sum = 0;
+                for(int x = (bx*image.cols)/SIGNATURE_SIZE; x < x_end; ++x){
+                    sum += p[x];
+                }
+                block_sums[bx] += sum;
+            }
+        }
+        for(int bx = 0; bx < SIGNATURE_SIZE; ++bx){
+            const int block_pixels = (y_end-y_begin)*(((bx+1)*image.cols)/SIGNATURE_SIZE - (bx*image.cols)/SIGNATURE_SIZE);
+            if(block_sums[bx] > 127*block_pixels){
+                const int bit = by*SIGNATURE_SIZE+bx;
+                signature[bit/64] |= (uint64_t)1 << (bit%64);
+            }
+        }
+    }
+}
+
+void mcv::marker::apply_AR(const mcv::Matcher& matcher, cv::Mat& camera_frame, bool debug_info) {
+    // Buffers of this pipeline live only for this frame, keep an ARPipeline to reuse them between frames
+    mcv::ARPipeline pipeline;
+    pipeline.applyAR(matcher, camera_frame, debug_info);
+}
@@ -5,6 +5,7 @@
 #ifndef PROJECT_MARKER_H
 #define PROJECT_MARKER_H
 
+#include <stdint.h>
 #include <opencv2/core/mat.hpp>
 #include "Matcher.h"
 
@@ -37,42 +38,59 @@ namespace mcv{
          *
          * */
         const float MATCH_THRESHOLD = 0.90f;
+        /// Size of the square canvas where candidates are warped, marker geometry below is defined for this canvas
+        const int CANVAS_SIZE = 256;
+
+        /**
+         * Scale a length of the CANVAS_SIZE canvas to a canvas of "canvas_size" pixels
+         */
+        constexpr int canvas_scale(int length, int canvas_size){
+            return (length*canvas_size)/CANVAS_SIZE;
+        }
+
         /// Constants related to marker orientation detection
         const int WIDTH = 135;
         const int HEIGHT = 55;
 
         const int OFFSET = 53; // marker border size
-        const std::vector< cv::Point > RECT_0 = {
-                cv::Point(256-(OFFSET+WIDTH), 256-(OFFSET+HEIGHT)),
-                cv::Point(256-OFFSET, 256-OFFSET)
-        };
-        const std::vector< cv::Point > RECT_90 = {
-                cv::Point(256-(OFFSET+HEIGHT), OFFSET),
-                cv::Point(256-OFFSET, OFFSET+WIDTH)
-        };
-        const std::vector< cv::Point > RECT_180 = {
-                cv::Point(OFFSET, OFFSET),
-                cv::Point(OFFSET+WIDTH, OFFSET+HEIGHT)
-        };
-        const std::vector< cv::Point > RECT_270 = {
-                cv::Point(OFFSET, 256-(OFFSET+WIDTH)),
-                cv::Point(OFFSET+HEIGHT, 256-OFFSET)
-        };
-
+        // Suggested min confidence of detect_orientation to compare a candidate with markers, rectangles of a real
+        // marker differ much more than this ( not measured yet, see mcv::ARPipeline::setOrientationMinConfidence )
+        const float ORIENTATION_MIN_CONFIDENCE = 0.05f;
         const std::vector<cv::Vec2d> DST_POINTS = {
                 cv::Vec2d(0, 0),
-                cv::Vec2d(256, 0),
-                cv::Vec2d(256, 256),
-                cv::Vec2d(0, 256),
+                cv::Vec2d(CANVAS_SIZE, 0),
+                cv::Vec2d(CANVAS_SIZE, CANVAS_SIZE),
+                cv::Vec2d(0, CANVAS_SIZE),
         };
 
+        /**
+         * This function computes the orientation rectangle of a rotation on a canvas of "canvas_size" pixels: a
+         * WIDTH x HEIGHT rectangle at OFFSET from the corner of the canvas selected by the rotation ( bottom right for 0
+         * degree ), lengths are scaled with canvas_scale. It is the only definition of the orientation rectangles
+         * @param rotation_degree: 0,90,180,270 to select the rectangle
+         * @param canvas_size: size of the square canvas
+         * @param top_left: output, top left corner of the rectangle
+         * @param bottom_right: output, bottom right corner of the rectangle
+         */
+        void orientation_rect(int rotation_degree, int canvas_size, cv::Point& top_left, cv::Point& bottom_right);
+
         /**
          * it detects orientation of a given marker and it returns its orientation in degree to obtain the original marker orientation
-         * @param warped_image: image which should contain a marker to work properly (must be thresholded and 256x256)
+         * @param warped_image: image which should contain a marker to work properly (must be thresholded and square,
+         * CANVAS_SIZE or smaller canvas)
          * @return 0,90,180,270 degree of rotation respect to the original marker
          */
         int detect_orientation(const cv::Mat& warped_image);
 
+        /**
+         * Same as detect_orientation but it also reports how much the orientation is reliable
+         * @param warped_image: image which should contain a marker to work properly (must be thresholded and square)
+         * @param confidence: if not null margin between the black pixels of the best orientation rectangle and the
+         * second best one, as fraction of rectangle area ( 0 means ambiguous orientation )
+         * @return 0,90,180,270 degree of rotation respect to the original marker
+         */
+        int detect_orientation(const cv::Mat& warped_image, float* confidence);
+
         /**
          * This function, given the "rotation_degree" obtained from detect_orientation function, calculates the rotation
          * matrix which will be saved into rotation_matrix
@@ -80,24 +98,122 @@ namespace mcv{
          * @param rotation_matrix: reference of matrix where rotation matrix will be set
          * @param rotation_degree: rotation in degree to obtain the original marker orientation
          * @param rotation_update: if this is true rotation matrix will be updated and not recreated
+         * @param canvas_size: size of the square canvas the matrix rotates ( CANVAS_SIZE for full size candidates )
          */
-        void calculate_rotation_matrix(cv::Mat& rotation_matrix, int rotation_degree, const bool rotation_update = false);
+        void calculate_rotation_matrix(cv::Mat& rotation_matrix, int rotation_degree, const bool rotation_update = false,
+                                       int canvas_size = CANVAS_SIZE);
 
         /**
          * This function works as calculate_rotation_matrix but it updates an already inited rotation_matrix which will be used to rotate picture before warp
          * @see calculate_rotation_matrix
          * @param rotation_matrix: reference of matrix where rotation matrix will be set
          * @param rotation_degree: rotation in degree to obtain the original marker orientation (WARNING not picture orientation but marker)
+         * @param canvas_size: size of the square canvas the matrix rotates
+         */
+        void calculate_picture_rotation(cv::Mat& rotation_matrix, int rotation_degree, int canvas_size = CANVAS_SIZE);
+
+        /**
+         * This function rotates a warped candidate to the original marker orientation, the result is the same of
+         * cv::warpPerspective with the inverse of calculate_rotation_matrix ( WARP_INVERSE_MAP, BORDER_DEFAULT ) but
+         * pixels are only moved because the rotation maps pixels into pixels
+         * @param warped_image: candidate warped into a square canvas
+         * @param rotated_image: output, it must be a different image from warped_image
+         * @param rotation_degree: rotation obtained from detect_orientation
+         */
+        void rotate_canvas(const cv::Mat& warped_image, cv::Mat& rotated_image, int rotation_degree);
+
+        /**
+         * This function folds the rotation of calculate_rotation_matrix into the homography H, the result is H followed
+         * by the rotation ( the same homography obtained permuting DST_POINTS of 90 degree steps ) and it maps the
+         * replacement picture directly into the frame ( with WARP_INVERSE_MAP ) without intermediate warp
+         * @param H: homography between candidate corners and DST_POINTS ( CV_64F )
+         * @param rotation_degree: rotation obtained from detect_orientation
+         * @param H_rotated: output homography ( CV_64F )
+         * @param canvas_size: size of the canvas H maps into ( see canvas_homography )
+         */
+        void rotate_homography(const cv::Mat& H, int rotation_degree, cv::Mat& H_rotated, int canvas_size = CANVAS_SIZE);
+
+        /**
+         * This function scales a homography to DST_POINTS so that it maps into a canvas of "canvas_size" pixels, the
+         * same homography obtained with DST_POINTS scaled to canvas_size ( candidates can be warped and matched on a
+         * smaller canvas without computing the homography again )
+         * @param H: homography between candidate corners and DST_POINTS ( CV_64F )
+         * @param canvas_size: size of the square canvas
+         * @param H_canvas: output homography ( CV_64F ), it can be H itself
          */
-        void calculate_picture_rotation(cv::Mat& rotation_matrix, int rotation_degree);
+        void canvas_homography(const cv::Mat& H, int canvas_size, cv::Mat& H_canvas);
 
         /**
          * This function computes the probability of a certain marker ( marker_extracted ) to be the "marker_candidate"
          * @param marker_extracted: marker extracted from frame
          * @param marker_candidate: one of the marker for the pictures ( OM or 1M )
+         * @param top_left: top left corner of the compared region
+         * @param bottom_right: bottom right corner of the compared region ( excluded ), (-1,-1) means the whole image
+         * @return probability that the two markers are the same
+         */
+        float compute_matching(const cv::Mat& marker_extracted, const cv::Mat& marker_candidate, cv::Point top_left = cv::Point(0,0), cv::Point bottom_right = cv::Point(-1,-1));
+
+        /**
+         * Bounded version of compute_matching on the whole image: similarity of each row is accumulated exactly as
+         * integer and comparison stops as soon as the remaining rows can't lift the score up to "bound"
+         * @param marker_extracted: marker extracted from frame
+         * @param marker_candidate: one of the marker for the pictures ( OM or 1M )
+         * @param bound: score to reach ( e.g. max between match threshold and best score found so far )
+         * @param skipped_rows: if not null the number of rows not compared is added to it
+         * @return probability that the two markers are the same, if comparison has been stopped the returned value is
+         * an upper bound of the probability which is lower than "bound"
+         */
+        float compute_matching_bounded(const cv::Mat& marker_extracted, const cv::Mat& marker_candidate, float bound, int* skipped_rows = nullptr);
+
+        /**
+         * Number of 64 bit words used by pack_bits for an image of size rows x cols ( each row starts into a new word )
+         */
+        inline int packed_words(int rows, int cols){
+            return rows*((cols+63)/64);
+        }
+
+        /**
+         * This function packs a thresholded image into 1 bit per pixel, bit is 1 if pixel is greater than 127
+         * @param image: thresholded image
+         * @param bits: destination of packed_words(image.rows, image.cols) words
+         */
+        void pack_bits(const cv::Mat& image, uint64_t* bits);
+
+        /**
+         * Same measure of compute_matching for binary images packed with pack_bits: equal pixels add 1 and different
+         * pixels add 0, so it is computed with XOR and popcount
+         * @param marker_extracted: packed marker extracted from frame
+         * @param marker_candidate: packed marker
+         * @param words: number of words of both markers
+         * @param pixels: number of pixels of both markers
          * @return probability that the two markers are the same
          */
-        float compute_matching(const cv::Mat& marker_extracted, const cv::Mat& marker_candidate, cv::Point top_left = cv::Point(0,0), cv::Point bottom_right = cv::Point(256,256));
+        float compute_matching_bits(const uint64_t* marker_extracted, const uint64_t* marker_candidate, int words, int pixels);
+
+        /**
+         * Bounded version of compute_matching_bits ( see compute_matching_bounded )
+         * @param marker_extracted: packed marker extracted from frame
+         * @param marker_candidate: packed marker
+         * @param rows: number of rows of both markers
+         * @param cols: number of columns of both markers
+         * @param bound: score to reach ( e.g. max between match threshold and best score found so far )
+         * @param skipped_rows: if not null the number of rows not compared is added to it
+         * @return probability that the two markers are the same or an upper bound lower than "bound"
+         */
+        float compute_matching_bits_bounded(const uint64_t* marker_extracted, const uint64_t* marker_candidate, int rows, int cols, float bound, int* skipped_rows = nullptr);
+
+        /// Constants related to marker signature ( SIGNATURE_SIZE x SIGNATURE_SIZE bits )
+        const int SIGNATURE_SIZE = 16;
+        const int SIGNATURE_WORDS = (SIGNATURE_SIZE*SIGNATURE_SIZE)/64;
+
+        /**
+         * This function computes a tiny signature of a thresholded marker: image is divided into
+         * SIGNATURE_SIZE x SIGNATURE_SIZE blocks and each block is 1 bit, 1 if its mean is greater than 127.
+         * Signatures are compared with compute_matching_bits to discard markers cheaply before the full comparison
+         * @param image: thresholded marker ( at least SIGNATURE_SIZE x SIGNATURE_SIZE )
+         * @param signature: destination of SIGNATURE_WORDS words
+         */
+        void compute_signature(const cv::Mat& image, uint64_t* signature);
 
 
 
@@ -128,6 +244,9 @@ namespace mcv{
          * @param img_1m_th: image marker 1 thresholded ( van marker )
          * @param camera_frame: original image on which AR will be applied
          * @param debug_info: if true additional images will be shown with debug pourpose
+         *
+         * This function is a wrapper of mcv::ARPipeline::applyAR, use an ARPipeline instance to process a sequence of
+         * frames without allocating intermediate images for each of them
          */
         void apply_AR(const mcv::Matcher& matcher, cv::Mat& camera_frame,  bool debug_info);
 
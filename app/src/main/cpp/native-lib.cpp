@@ -1,8 +1,36 @@
 #include <jni.h>
+#include <android/log.h>
 #include <string>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include "marker.h"
+#include "ARPipeline.h"
+
+namespace {
+    const char* LOG_TAG = "PictureAR";
+
+    /**
+     * Native state behind a PictureAR handle: markers are registered once and the pipeline keeps its buffers
+     * between frames, so each frame only needs the frame itself
+     */
+    struct NativePictureAR {
+        mcv::Matcher matcher;
+        mcv::ARPipeline pipeline;
+
+        NativePictureAR(){
+            // candidates are compared on pixel intensities: warped candidates aren't binary near edges so BIT_PACKED
+            // scores can differ near the threshold, it hasn't been measured on real captures yet
+            // ( see mcv::Matcher::setMode )
+            // coarse matching isn't enabled: the app registers a few markers and all of them are fully compared anyway
+            // ( see mcv::Matcher::setCoarseCandidates )
+            // candidates are matched on the full size canvas: detection rates of smaller canvases haven't been
+            // measured yet ( see mcv::Matcher::setCanvasSize )
+            // tracking isn't enabled: markers entering the view while tracks exist are found only by the next full
+            // detection and tracked corners are verified only by the match score, the trade-off hasn't been measured
+            // yet ( see mcv::ARPipeline::setTracking )
+        }
+    };
+}
 
 extern "C" {
 
@@ -34,6 +62,64 @@ JNIEXPORT void JNICALL Java_it_signoretto_marco_picturear_PictureAR_applyAR(
     }
 }
 
+JNIEXPORT jlong JNICALL Java_it_signoretto_marco_picturear_PictureAR_nativeCreate(
+        JNIEnv *env,
+        jobject /* this */) {
+    return (jlong) new NativePictureAR();
+}
+
+JNIEXPORT jint JNICALL Java_it_signoretto_marco_picturear_PictureAR_nativeRegisterMarker(
+        JNIEnv *env,
+        jobject, /* this */
+        jlong j_handle,
+        jlong j_marker_th,
+        jlong j_replacement) {
+
+    if (j_handle == 0) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "registerMarker called after release");
+        return -1;
+    }
+    NativePictureAR &native = *(NativePictureAR *) j_handle;
+    cv::Mat &marker_th = *(cv::Mat *) j_marker_th;
+    cv::Mat &replacement = *(cv::Mat *) j_replacement;
+
+    try {
+        return native.matcher.addMarker(marker_th, replacement);
+    } catch (const cv::Exception &e) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "Marker registration failed: %s", e.what());
+        return -1;
+    }
+}
+
+JNIEXPORT void JNICALL Java_it_signoretto_marco_picturear_PictureAR_nativeProcessFrame(
+        JNIEnv *env,
+        jobject, /* this */
+        jlong j_handle,
+        jlong j_frame,
+        jboolean debug_info) {
+
+    if (j_handle == 0) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "processFrame called after release");
+        return;
+    }
+    NativePictureAR &native = *(NativePictureAR *) j_handle;
+    cv::Mat &frame = *(cv::Mat *) j_frame;
+
+    try {
+        native.pipeline.applyAR(native.matcher, frame, debug_info);
+    } catch (const cv::Exception &e) {
+        // the frame is shown as it is
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "Frame processing failed: %s", e.what());
+    }
+}
+
+JNIEXPORT void JNICALL Java_it_signoretto_marco_picturear_PictureAR_nativeDestroy(
+        JNIEnv *env,
+        jobject, /* this */
+        jlong j_handle) {
+    delete (NativePictureAR *) j_handle;
+}
+
 
 }
 
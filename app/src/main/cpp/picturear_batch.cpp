@@ -0,0 +1,543 @@
+//
+// Offline tool which applies AR to a directory of images or to a video file
+//
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ARPipeline.h"
+#include "FrameExecutor.h"
+#include "Matcher.h"
+#include "marker.h"
+
+namespace {
+    // Frames read for each worker before processing them, larger batches hide differences between frames
+    const int FRAMES_PER_WORKER = 4;
+
+    /**
+     * Command line options
+     */
+    struct Options {
+        std::vector<std::string> markers; // thresholded markers
+        std::vector<std::string> replacements; // one replacement for each marker
+        std::string input; // directory of images or video file
+        std::string output; // directory of composited frames
+        std::string log; // detection log, <output>/detections.csv if empty
+        int workers = 0; // 0 means one worker for each core
+        int canvas_size = 0; // 0 means default canvas of mcv::Matcher
+        int coarse_candidates = 0; // 0 means that all markers are fully compared
+        bool bit_packed = false; // candidates compared with mcv::match_mode::BIT_PACKED instead of INTENSITY
+        int detection_scale = 1;
+        bool pipelined = false; // frames processed by mcv::FrameExecutor instead of the worker pool
+        int depth = 2; // capacity of the queues of mcv::FrameExecutor
+        bool drop_frames = false; // frames submitted as soon as they are read, as a camera does
+        bool parallel_boundaries = false;
+        bool chain_code = false;
+        bool polygon = false;
+        bool measure_scale = false; // detections at detection_scale compared with the ones at scale 1
+        float orientation_confidence = 0.0f; // 0 means that no candidate is rejected by its orientation
+        bool measure_orientation = false; // detections with orientation_confidence compared with the ones without it
+    };
+
+    /**
+     * A frame read from input with the detections found into it
+     */
+    struct Job {
+        std::string name; // name of the composited frame
+        cv::Mat frame; // RGBA as camera frames of the app
+        std::vector<mcv::ARPipeline::Detection> detections;
+        std::string error; // not empty if the frame couldn't be processed or written
+        std::vector<mcv::ARPipeline::Detection> reference; // detections of the reference pipeline ( only with
+                                                          // measure_scale or measure_orientation )
+    };
+
+    /**
+     * Comparison between detections at the selected detection scale and at scale 1 ( --measure-scale ) or between
+     * detections with and without the orientation confidence ( --measure-orientation )
+     */
+    struct DetectionMeasure {
+        long reference = 0; // markers found by the reference pipeline
+        long found = 0; // markers found by the reference pipeline and also by the measured one
+        long extra = 0; // markers found only by the measured pipeline
+        double error_sum = 0.0; // sum over found markers of their max corner distance
+        double error_max = 0.0;
+    };
+
+    void printUsage(const char* program){
+        std::cerr << "Usage: " << program << " --marker <marker> <replacement> [--marker ...] --input <directory|video> --output <directory>" << std::endl
+                  << "       [--log <file>] [--workers <n>] [--canvas <size>] [--coarse <n>] [--bit-packed] [--scale <1|2|4>]" << std::endl
+                  << "       [--pipelined [--depth <n>] [--drop-frames]] [--parallel-boundaries] [--chain-code] [--polygon]" << std::endl
+                  << "       [--measure-scale] [--orientation-confidence <value> [--measure-orientation]]" << std::endl;
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options){
+        for(int i = 1; i < argc; ++i){
+            const std::string arg = argv[i];
+            const int remaining = argc - i - 1;
+            if(arg == "--marker" && remaining >= 2){
+                options.markers.push_back(argv[++i]);
+                options.replacements.push_back(argv[++i]);
+            }else if(arg == "--input" && remaining >= 1){
+                options.input = argv[++i];
+            }else if(arg == "--output" && remaining >= 1){
+                options.output = argv[++i];
+            }else if(arg == "--log" && remaining >= 1){
+                options.log = argv[++i];
+            }else if(arg == "--workers" && remaining >= 1){
+                options.workers = std::atoi(argv[++i]);
+            }else if(arg == "--canvas" && remaining >= 1){
+                options.canvas_size = std::atoi(argv[++i]);
+            }else if(arg == "--coarse" && remaining >= 1){
+                options.coarse_candidates = std::atoi(argv[++i]);
+            }else if(arg == "--bit-packed"){
+                options.bit_packed = true;
+            }else if(arg == "--scale" && remaining >= 1){
+                options.detection_scale = std::atoi(argv[++i]);
+            }else if(arg == "--pipelined"){
+                options.pipelined = true;
+            }else if(arg == "--depth" && remaining >= 1){
+                options.depth = std::atoi(argv[++i]);
+            }else if(arg == "--drop-frames"){
+                options.drop_frames = true;
+            }else if(arg == "--parallel-boundaries"){
+                options.parallel_boundaries = true;
+            }else if(arg == "--chain-code"){
+                options.chain_code = true;
+            }else if(arg == "--polygon"){
+                options.polygon = true;
+            }else if(arg == "--measure-scale"){
+                options.measure_scale = true;
+            }else if(arg == "--orientation-confidence" && remaining >= 1){
+                options.orientation_confidence = (float)std::atof(argv[++i]);
+            }else if(arg == "--measure-orientation"){
+                options.measure_orientation = true;
+            }else{
+                std::cerr << "Invalid argument: " << arg << std::endl;
+                return false;
+            }
+        }
+        if(options.markers.empty() || options.input.empty() || options.output.empty()){
+            return false;
+        }
+        if(options.detection_scale != 1 && options.detection_scale != 2 && options.detection_scale != 4){
+            std::cerr << "Detection scale must be 1, 2 or 4" << std::endl;
+            return false;
+        }
+        if(options.detection_scale > 1 && !options.polygon){
+            std::cerr << "Detection scale 2 and 4 need --polygon" << std::endl;
+            return false;
+        }
+        if(options.measure_scale && (options.detection_scale == 1 || options.pipelined)){
+            std::cerr << "--measure-scale needs --scale 2 or 4 and the worker pool" << std::endl;
+            return false;
+        }
+        if(options.measure_orientation && (options.orientation_confidence <= 0.0f || options.measure_scale || options.pipelined)){
+            std::cerr << "--measure-orientation needs --orientation-confidence, the worker pool and no --measure-scale" << std::endl;
+            return false;
+        }
+        if(options.canvas_size != 0 && options.canvas_size < mcv::marker::SIGNATURE_SIZE){
+            std::cerr << "Canvas size must be at least " << mcv::marker::SIGNATURE_SIZE << std::endl;
+            return false;
+        }
+        if(options.depth < 1){
+            std::cerr << "Queue depth must be at least 1" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool isDirectory(const std::string& path){
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    bool isImage(const std::string& path){
+        static const char* EXTENSIONS[] = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff"};
+        const size_t dot = path.find_last_of('.');
+        if(dot == std::string::npos)return false;
+        std::string extension = path.substr(dot);
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){ return (char)std::tolower(c); });
+        for(const char* e : EXTENSIONS){
+            if(extension == e)return true;
+        }
+        return false;
+    }
+
+    std::string baseName(const std::string& path){
+        const size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    /**
+     * Frames of a directory of images ( sorted by name ) or of a video file
+     */
+    class FrameSource {
+    private:
+        std::vector<std::string> m_images;
+        size_t m_next = 0;
+        cv::VideoCapture m_video;
+        long m_frame_index = 0;
+        cv::Mat m_bgr;
+
+    public:
+        bool open(const std::string& input){
+            if(isDirectory(input)){
+                std::vector<std::string> files;
+                cv::glob(input + "/*", files, false); // sorted by name
+                for(const std::string& file : files){
+                    if(isImage(file))m_images.push_back(file);
+                }
+                return true;
+            }
+            return m_video.open(input);
+        }
+
+        /**
+         * Read next frame into "job" converted to RGBA
+         * @return false at the end of input
+         */
+        bool read(Job& job){
+            if(m_video.isOpened()){
+                if(!m_video.read(m_bgr) || m_bgr.empty())return false;
+                char name[32];
+                std::snprintf(name, sizeof(name), "frame_%06ld.png", m_frame_index++);
+                job.name = name;
+            }else{
+                // Unreadable files are skipped
+                do{
+                    if(m_next >= m_images.size())return false;
+                    m_bgr = cv::imread(m_images[m_next]);
+                    job.name = baseName(m_images[m_next++]);
+                }while(m_bgr.empty());
+            }
+            cv::cvtColor(m_bgr, job.frame, cv::COLOR_BGR2RGBA);
+            return true;
+        }
+    };
+
+    /**
+     * Append detections of "job" to the log, one row for each marker and a row with marker -1 for frames without
+     * markers
+     */
+    void writeLog(std::ofstream& log, long frame_index, const Job& job){
+        if(job.detections.empty()){
+            log << frame_index << "," << job.name << ",-1,,,,,,,,,\n";
+            return;
+        }
+        for(const mcv::ARPipeline::Detection& detection : job.detections){
+            log << frame_index << "," << job.name << "," << detection.marker_index << "," << detection.orientation;
+            for(const cv::Vec2d& corner : detection.corners){
+                log << "," << corner[0] << "," << corner[1];
+            }
+            log << "\n";
+        }
+    }
+
+    /**
+     * Write the composited frame of "job" into the output directory
+     * @param bgr: buffer of the converted frame
+     * @return false if the frame can't be written
+     */
+    bool writeFrame(const Options& options, const Job& job, cv::Mat& bgr){
+        cv::cvtColor(job.frame, bgr, cv::COLOR_RGBA2BGR);
+        return cv::imwrite(options.output + "/" + job.name, bgr);
+    }
+
+    /**
+     * Keep "error" into the job and drop its partial detections, so a failed frame isn't measured
+     */
+    void failJob(Job& job, const std::string& error){
+        job.detections.clear();
+        job.reference.clear();
+        job.error = error;
+    }
+
+    /**
+     * Apply AR to the frame of "job" and write it, errors are kept into the job so one bad frame doesn't stop the run
+     */
+    void processJob(const Options& options, const mcv::Matcher& matcher, mcv::ARPipeline& pipeline, Job& job, cv::Mat& bgr,
+                    mcv::ARPipeline* reference, cv::Mat& reference_frame){
+        job.error.clear();
+        job.reference.clear();
+        try {
+            if(reference != nullptr){
+                // the reference runs on a copy, applyAR draws into the frame
+                job.frame.copyTo(reference_frame);
+                reference->applyAR(matcher, reference_frame, false);
+                reference->getDetections(job.reference);
+            }
+            pipeline.applyAR(matcher, job.frame, false);
+            pipeline.getDetections(job.detections);
+            if(!writeFrame(options, job, bgr)){
+                job.error = "impossible to write the composited frame";
+            }
+        } catch (const cv::Exception& e) {
+            failJob(job, e.what());
+        } catch (const std::exception& e) {
+            failJob(job, e.what());
+        } catch (...) {
+            failJob(job, "unknown error while applying AR");
+        }
+    }
+
+    /**
+     * Read up to batch.size() frames
+     * @return number of frames read, less than batch.size() at the end of input
+     */
+    int readBatch(FrameSource& source, std::vector<Job>& batch){
+        int batch_size = 0;
+        while(batch_size < (int)batch.size() && source.read(batch[batch_size])){
+            ++batch_size;
+        }
+        return batch_size;
+    }
+
+    void configurePipeline(const Options& options, mcv::ARPipeline& pipeline, int detection_scale, float orientation_confidence){
+        // corner detector first, detection scales over 1 need POLYGON
+        pipeline.setCornerDetector(options.polygon ? mcv::corner_detector::POLYGON : mcv::corner_detector::HARRIS);
+        pipeline.setDetectionScale(detection_scale);
+        pipeline.setParallelBoundaries(options.parallel_boundaries);
+        pipeline.setBoundaryStorage(options.chain_code ? mcv::boundary_storage::CHAIN_CODE : mcv::boundary_storage::POINTS);
+        pipeline.setOrientationMinConfidence(orientation_confidence);
+    }
+
+    /**
+     * Add detections of "job" to the measure: a reference marker is found if the same marker has been detected by
+     * the measured pipeline, its error is the max distance of a reference corner from the nearest detected corner
+     * ( the first corner of a boundary can change with the scale )
+     */
+    void measureJob(const Job& job, DetectionMeasure& measure){
+        std::vector<bool> used(job.detections.size(), false);
+        for(const mcv::ARPipeline::Detection& reference : job.reference){
+            ++measure.reference;
+            int best = -1;
+            double best_error = 0.0;
+            for(size_t d = 0; d < job.detections.size(); ++d){
+                if(used[d] || job.detections[d].marker_index != reference.marker_index)continue;
+                double error = 0.0;
+                for(const cv::Vec2d& corner : reference.corners){
+                    double nearest = -1.0;
+                    for(const cv::Vec2d& detected : job.detections[d].corners){
+                        const double distance = std::hypot(corner[0] - detected[0], corner[1] - detected[1]);
+                        if(nearest < 0.0 || distance < nearest)nearest = distance;
+                    }
+                    error = std::max(error, nearest);
+                }
+                if(best == -1 || error < best_error){
+                    best = (int)d;
+                    best_error = error;
+                }
+            }
+            if(best > -1){
+                used[best] = true;
+                ++measure.found;
+                measure.error_sum += best_error;
+                measure.error_max = std::max(measure.error_max, best_error);
+            }
+        }
+        measure.extra += (long)std::count(used.begin(), used.end(), false);
+    }
+
+    /**
+     * Process all frames with a pool of workers, each one with its own pipeline: frames of a batch are independent so
+     * tracking isn't used and candidates of a frame are processed serially, the pool already keeps all cores busy.
+     * Workers also convert and encode their composited frames, only the log is written serially in input order
+     */
+    void runBatch(const Options& options, const mcv::Matcher& matcher, FrameSource& source, std::ofstream& log,
+                  long& frames, long& detections){
+        const int workers = options.workers > 0 ? options.workers : std::max(1, (int)std::thread::hardware_concurrency());
+        std::vector<mcv::ARPipeline> pipelines(workers);
+        for(mcv::ARPipeline& pipeline : pipelines){
+            configurePipeline(options, pipeline, options.detection_scale, options.orientation_confidence);
+            pipeline.setParallelCandidates(false);
+        }
+        // Pipelines with the same settings at scale 1 or without orientation confidence, used only to measure them
+        const bool measure = options.measure_scale || options.measure_orientation;
+        std::vector<mcv::ARPipeline> references(measure ? workers : 0);
+        for(mcv::ARPipeline& pipeline : references){
+            configurePipeline(options, pipeline, options.measure_scale ? 1 : options.detection_scale,
+                              options.measure_orientation ? 0.0f : options.orientation_confidence);
+            pipeline.setParallelCandidates(false);
+        }
+        DetectionMeasure detection_measure;
+
+        // Two batches: frames are read serially ( video decoding is sequential ) into one while the pool processes
+        // and writes the other
+        std::vector<Job> batches[2] = {std::vector<Job>(workers*FRAMES_PER_WORKER), std::vector<Job>(workers*FRAMES_PER_WORKER)};
+        int current = 0;
+        int batch_size = readBatch(source, batches[current]);
+        while(batch_size > 0){
+            std::vector<Job>& batch = batches[current];
+            std::atomic<int> next(0);
+            std::vector<std::thread> threads;
+            for(int w = 0; w < workers; ++w){
+                threads.push_back(std::thread([&, w](){
+                    cv::Mat bgr, reference_frame;
+                    mcv::ARPipeline* reference = measure ? &(references[w]) : nullptr;
+                    for(int i = next++; i < batch_size; i = next++){
+                        processJob(options, matcher, pipelines[w], batch[i], bgr, reference, reference_frame);
+                    }
+                }));
+            }
+            const int next_size = batch_size == (int)batch.size() ? readBatch(source, batches[1 - current]) : 0;
+            for(std::thread& thread : threads){
+                thread.join();
+            }
+
+            // Only errors and log are written here, in input order
+            for(int i = 0; i < batch_size; ++i, ++frames){
+                if(!batch[i].error.empty()){
+                    std::cerr << "Frame " << batch[i].name << " skipped: " << batch[i].error << std::endl;
+                }
+                writeLog(log, frames, batch[i]);
+                detections += (long)batch[i].detections.size();
+                if(measure){
+                    measureJob(batch[i], detection_measure);
+                }
+            }
+            current = 1 - current;
+            batch_size = next_size;
+        }
+
+        if(options.measure_scale){
+            std::cout << "Scale " << options.detection_scale << " against scale 1: " << detection_measure.found << " of "
+                      << detection_measure.reference << " markers found, " << detection_measure.extra << " markers not found at scale 1, corner error mean "
+                      << (detection_measure.found > 0 ? detection_measure.error_sum/detection_measure.found : 0.0) << " px max " << detection_measure.error_max << " px" << std::endl;
+        }else if(options.measure_orientation){
+            std::cout << "Orientation confidence " << options.orientation_confidence << " against no confidence: " << detection_measure.found << " of "
+                      << detection_measure.reference << " markers found, " << (detection_measure.reference - detection_measure.found) << " markers lost" << std::endl;
+        }
+    }
+
+    /**
+     * Process all frames as a stream with mcv::FrameExecutor, the stages of consecutive frames overlap. Frames are
+     * submitted when the first queue has room, or as soon as they are read with drop_frames so that frames are
+     * dropped when the pipeline is slower than the input. Occupancy of the queues is sampled at each submission and
+     * reported with the dropped frames
+     */
+    void runPipelined(const Options& options, const mcv::Matcher& matcher, FrameSource& source, std::ofstream& log,
+                      long& frames, long& detections){
+        static const char* STAGE_NAMES[] = {"threshold", "corners", "match", "composite"};
+        static const mcv::executor_stage STAGES[] = {mcv::executor_stage::THRESHOLD, mcv::executor_stage::CORNERS,
+                                                     mcv::executor_stage::MATCH, mcv::executor_stage::COMPOSITE};
+        mcv::ARPipeline pipeline;
+        configurePipeline(options, pipeline, options.detection_scale, options.orientation_confidence);
+        mcv::FrameExecutor executor(pipeline, matcher, options.depth);
+
+        std::vector<std::string> names; // name of each submitted frame by submission index
+        double occupancy[4] = {0.0}; // sum of samples of each stage queue
+        double output_occupancy = 0.0;
+        long samples = 0;
+        Job input, output;
+        cv::Mat bgr;
+        bool end = false;
+        while(!end || executor.getFramesInFlight() > 0){
+            bool busy = false;
+            if(!end && (options.drop_frames || executor.getQueueOccupancy(mcv::executor_stage::THRESHOLD) < options.depth)){
+                if(source.read(input)){
+                    for(int s = 0; s < 4; ++s){
+                        occupancy[s] += executor.getQueueOccupancy(STAGES[s]);
+                    }
+                    output_occupancy += executor.getOutputOccupancy();
+                    ++samples;
+                    executor.submit(input.frame);
+                    names.push_back(input.name);
+                    busy = true;
+                }else{
+                    end = true;
+                }
+            }
+            long index = 0;
+            while(executor.retrieve(output.frame, &index, &(output.detections))){
+                output.name = names[index];
+                if(!writeFrame(options, output, bgr)){
+                    std::cerr << "Impossible to write " << output.name << std::endl;
+                }
+                writeLog(log, index, output);
+                detections += (long)output.detections.size();
+                ++frames;
+                busy = true;
+            }
+            if(!busy){
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+
+        std::cout << executor.getDroppedFrames() << " frames dropped, average queue occupancy:";
+        for(int s = 0; s < 4; ++s){
+            std::cout << " " << STAGE_NAMES[s] << " " << (samples > 0 ? occupancy[s]/samples : 0.0);
+        }
+        std::cout << " output " << (samples > 0 ? output_occupancy/samples : 0.0) << " ( depth " << options.depth << " )" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if(!parseOptions(argc, argv, options)){
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Markers and replacements are prepared as the app does: gray scale markers and RGBA replacements
+    mcv::Matcher matcher;
+    matcher.setMode(options.bit_packed ? mcv::match_mode::BIT_PACKED : mcv::match_mode::INTENSITY);
+    if(options.canvas_size > 0){
+        matcher.setCanvasSize(options.canvas_size);
+    }
+    // index is built once for all markers when they are registered
+    matcher.setCoarseCandidates(options.coarse_candidates);
+    for(size_t i = 0; i < options.markers.size(); ++i){
+        const cv::Mat marker = cv::imread(options.markers[i], cv::IMREAD_GRAYSCALE);
+        const cv::Mat replacement = cv::imread(options.replacements[i]);
+        if(marker.empty() || replacement.empty()){
+            std::cerr << "Impossible to load marker " << options.markers[i] << " or replacement " << options.replacements[i] << std::endl;
+            return 1;
+        }
+        cv::Mat replacement_rgba;
+        cv::cvtColor(replacement, replacement_rgba, cv::COLOR_BGR2RGBA);
+        matcher.addMarker(marker, replacement_rgba);
+    }
+
+    FrameSource source;
+    if(!source.open(options.input)){
+        std::cerr << "Impossible to open input " << options.input << std::endl;
+        return 1;
+    }
+    if(!isDirectory(options.output) && mkdir(options.output.c_str(), 0755) != 0){
+        std::cerr << "Impossible to create output directory " << options.output << std::endl;
+        return 1;
+    }
+    std::ofstream log(options.log.empty() ? options.output + "/detections.csv" : options.log);
+    if(!log){
+        std::cerr << "Impossible to write detection log" << std::endl;
+        return 1;
+    }
+    log << "frame,name,marker,orientation,x0,y0,x1,y1,x2,y2,x3,y3\n";
+
+    long frames = 0;
+    long detections = 0;
+    if(options.pipelined){
+        runPipelined(options, matcher, source, log, frames, detections);
+    }else{
+        runBatch(options, matcher, source, log, frames, detections);
+    }
+
+    std::cout << frames << " frames processed, " << detections << " markers found" << std::endl;
+    return 0;
+}
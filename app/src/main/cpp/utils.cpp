@@ -2,10 +2,19 @@
 // Created by Marco Signoretto on 07/03/2017.
 //
 #include <iostream>
+#include <cstring>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include "utils.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 cv::Mat mcv::normalize_hist(cv::Mat &hist, const cv::Mat &image){
     //we use float data into normalized histogram because as necessary precision and it uses less memory than double
     float pixels = image.rows*image.cols;
@@ -133,15 +142,145 @@ cv::Mat mcv::image_threshold(int threshold, const cv::Mat &image_gray){
 
 void mcv::image_otsu_thresholding(const cv::Mat &image_gray, cv::Mat& image_th) {
     assert(image_gray.channels()==1 && "Invalid channels number");
-    //Calculate histogram
-    int max_value;
-    cv::Mat hist = compute_hist(image_gray, max_value);
-    // normalize histogram
-    cv::Mat normHist = normalize_hist(hist, image_gray);
-    //compute OtsuThresholding
-    int threshold = compute_Otsu_thresholding(normHist);
-    //generate image from threshold
-    image_th = image_threshold(threshold, image_gray);
+    // Same result of hist + normalization + thresholding functions without intermediate matrices
+    otsu_thresholding_fused(image_gray, image_th);
+}
+
+int mcv::compute_otsu_threshold_fused(const cv::Mat& image_gray) {
+    assert(image_gray.channels()==1 && "Invalid channels number");
+    const int BANKS = 4;
+    const int LEVELS = 256;
+    // use 32 bits for the same reason of compute_hist, one histogram for each bank
+    unsigned int hist[BANKS][LEVELS] = {{0}};
+
+    int nRows = image_gray.rows;
+    int nCols = image_gray.cols;
+    if(image_gray.isContinuous()){
+        // Continuous image can be seen as a single row
+        nCols *= nRows;
+        nRows = 1;
+    }
+
+    const uchar* p;
+    for(int i = 0; i < nRows; ++i) {
+        p = image_gray.ptr<uchar>(i);
+        int j = 0;
+        // Consecutive pixels go into different banks
+        for(; j <= nCols-BANKS; j += BANKS){
+            ++hist[0][p[j]];
+            ++hist[1][p[j+1]];
+            ++hist[2][p[j+2]];
+            ++hist[3][p[j+3]];
+        }
+        for(; j < nCols; ++j){
+            ++hist[0][p[j]];
+        }
+    }
+
+    // Merge banks, normalize histogram and compute global mean ( the last value of compute_cumulative_mean )
+    const float pixels = image_gray.rows*image_gray.cols;
+    float norm_hist[LEVELS];
+    float global_mean = 0.0f;
+    for(int l = 0; l < LEVELS; ++l){
+        norm_hist[l] = (float)(hist[0][l] + hist[1][l] + hist[2][l] + hist[3][l]) / pixels;
+        global_mean += (float)(l+1) * norm_hist[l];
+    }
+
+    // Single pass threshold search, CDF and cumulative mean are accumulated while searching
+    float max = -1.0f;
+    int threshold = -1;
+    float cum_sum = 0.0f;
+    float cum_mean = 0.0f;
+    for(int l = 0; l < LEVELS; ++l){
+        cum_sum += norm_hist[l];
+        cum_mean += (float)(l+1) * norm_hist[l];
+        const float diff = global_mean * cum_sum - cum_mean;
+        const float between_variance = (diff * diff) / (cum_sum * (1.0f - cum_sum));
+        if(between_variance > max){
+            max = between_variance;
+            threshold = l;
+        }
+    }
+    assert(threshold>=0 && "Threshold must be greater than zero (empty image?)");
+    return threshold;
+}
+
+void mcv::threshold_row(int threshold, const uchar* src, uchar* dst, int length) {
+    // Corner cases out of uchar range
+    if(threshold < 0){
+        memset(dst, 255, (size_t)length);
+        return;
+    }
+    if(threshold >= 255){
+        memset(dst, 0, (size_t)length);
+        return;
+    }
+
+    int j = 0;
+#if defined(__AVX2__)
+    // There isn't unsigned compare, so flip sign bit of both operands and use signed compare
+    const __m256i sign = _mm256_set1_epi8((char)0x80);
+    const __m256i th32 = _mm256_set1_epi8((char)(threshold ^ 0x80));
+    for(; j <= length-32; j += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src+j));
+        _mm256_storeu_si256((__m256i*)(dst+j), _mm256_cmpgt_epi8(_mm256_xor_si256(v, sign), th32));
+    }
+#elif defined(__SSE2__)
+    // There isn't unsigned compare, so flip sign bit of both operands and use signed compare
+    const __m128i sign = _mm_set1_epi8((char)0x80);
+    const __m128i th16 = _mm_set1_epi8((char)(threshold ^ 0x80));
+    for(; j <= length-16; j += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(src+j));
+        _mm_storeu_si128((__m128i*)(dst+j), _mm_cmpgt_epi8(_mm_xor_si128(v, sign), th16));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const uint8x16_t th16 = vdupq_n_u8((uint8_t)threshold);
+    for(; j <= length-16; j += 16){
+        vst1q_u8(dst+j, vcgtq_u8(vld1q_u8(src+j), th16));
+    }
+#endif
+    // Remaining pixels ( or all pixels without SIMD )
+    for(; j < length; ++j){
+        dst[j] = (src[j] > threshold)? WHITE : BLACK;
+    }
+}
+
+int mcv::otsu_thresholding_fused(const cv::Mat& image_gray, cv::Mat& image_th, const int padding) {
+    assert(image_gray.channels()==1 && "Invalid channels number");
+    assert(padding >= 0 && "Invalid padding");
+    assert(image_th.data != image_gray.data && "In place thresholding is not supported");
+
+    int threshold = compute_otsu_threshold_fused(image_gray);
+    threshold_padded(threshold, image_gray, image_th, padding);
+    return threshold;
+}
+
+void mcv::threshold_padded(int threshold, const cv::Mat& image_gray, cv::Mat& image_th, const int padding) {
+    assert(image_gray.channels()==1 && "Invalid channels number");
+    assert(padding >= 0 && "Invalid padding");
+    assert(image_th.data != image_gray.data && "In place thresholding is not supported");
+
+    const int nRows = image_gray.rows;
+    const int nCols = image_gray.cols;
+    image_th.create(nRows+2*padding, nCols+2*padding, CV_8UC1); // no allocation if already of this size
+
+    if(padding == 0 && image_gray.isContinuous() && image_th.isContinuous()){
+        threshold_row(threshold, image_gray.ptr<uchar>(0), image_th.ptr<uchar>(0), nRows*nCols);
+        return;
+    }
+
+    // Padding rows
+    for(int i = 0; i < padding; ++i){
+        memset(image_th.ptr<uchar>(i), BLACK, (size_t)image_th.cols);
+        memset(image_th.ptr<uchar>(image_th.rows-1-i), BLACK, (size_t)image_th.cols);
+    }
+    for(int i = 0; i < nRows; ++i){
+        uchar* p = image_th.ptr<uchar>(i+padding);
+        // Padding columns
+        memset(p, BLACK, (size_t)padding);
+        memset(p+padding+nCols, BLACK, (size_t)padding);
+        threshold_row(threshold, image_gray.ptr<uchar>(i), p+padding, nCols);
+    }
 }
 
 void mcv::compute_rho_theta_plane(const cv::Mat &window_mat, cv::Mat& H, cv::Point2f& best_rho_theta) {
@@ -83,6 +83,46 @@ namespace mcv{
      */
     void image_otsu_thresholding(const cv::Mat& image_gray, cv::Mat& image_th);
 
+    /**
+     * Calculate Otsu threshold of an 8-bit gray scale image fusing histogram, normalization, CDF, cumulative mean and
+     * threshold search: histogram is computed in a single pass over the image with multiple banks ( consecutive pixels
+     * with the same intensity don't wait each other increment ) and the search is a single pass over a stack array.
+     * The result is the same of compute_Otsu_thresholding
+     * @param image_gray: input grayscale image
+     * @return best threshold for Otsu tecnique
+     */
+    int compute_otsu_threshold_fused(const cv::Mat& image_gray);
+
+    /**
+     * Threshold "length" pixels of "src" into "dst": 255 if pixel is greater than threshold 0 otherwise.
+     * It uses AVX2, SSE2 or NEON when available
+     * @param threshold: param the separate black and white values
+     * @param src: source pixels
+     * @param dst: destination pixels ( it can't overlap src )
+     * @param length: number of pixels
+     */
+    void threshold_row(int threshold, const uchar* src, uchar* dst, int length);
+
+    /**
+     * Same as image_otsu_thresholding but it uses compute_otsu_threshold_fused and threshold_row, the result can be
+     * written directly with a border of "padding" pixels set to BLACK ( e.g. padding = 1 is the padded image used by
+     * boundary_extractor ). image_th is reallocated only if its size or type is different
+     * @param image_gray: input grayscale image
+     * @param image_th: output thresholded image with size (rows+2*padding, cols+2*padding)
+     * @param padding: number of BLACK pixels around the thresholded image
+     * @return threshold applied
+     */
+    int otsu_thresholding_fused(const cv::Mat& image_gray, cv::Mat& image_th, const int padding = 0);
+
+    /**
+     * Same as otsu_thresholding_fused but with a given threshold ( e.g. Otsu threshold computed on a downscaled frame )
+     * @param threshold: param the separate black and white values
+     * @param image_gray: input grayscale image
+     * @param image_th: output thresholded image with size (rows+2*padding, cols+2*padding)
+     * @param padding: number of BLACK pixels around the thresholded image
+     */
+    void threshold_padded(int threshold, const cv::Mat& image_gray, cv::Mat& image_th, const int padding = 0);
+
     /**
      *
      * @param window_mat: input matrix
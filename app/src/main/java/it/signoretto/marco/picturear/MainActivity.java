@@ -57,6 +57,8 @@ public class MainActivity extends CameraActivity implements CvCameraViewListener
     private Mat img_0m_th;
     private Mat img_1m_th;
 
+    private volatile PictureAR pictureAR;
+
     @Override
     public void onCreate(Bundle savedInstanceState) {
         Log.i(TAG, "called onCreate");
@@ -113,6 +115,10 @@ public class MainActivity extends CameraActivity implements CvCameraViewListener
             cameraDevice.close();
             cameraDevice = null;
         }
+        if (pictureAR != null) {
+            pictureAR.release();
+            pictureAR = null;
+        }
     }
 
     public void onCameraViewStarted(int width, int height) {
@@ -125,7 +131,10 @@ public class MainActivity extends CameraActivity implements CvCameraViewListener
 
     public Mat onCameraFrame(CvCameraViewFrame inputFrame) {
         Mat frame = inputFrame.rgba();
-        PictureAR.apply_AR(img_0p_rgba, img_1p_rgba, img_0m_th, img_1m_th, frame, false);
+        PictureAR ar = pictureAR;
+        if (ar != null) {
+            ar.processFrame(frame, false);
+        }
         return frame;
     }
 
@@ -157,6 +166,14 @@ public class MainActivity extends CameraActivity implements CvCameraViewListener
 
             img_1m_th = new Mat(img_1m.rows(), img_1m.cols(), CV_8UC1);
             Imgproc.cvtColor(img_1m, img_1m_th, Imgproc.COLOR_BGR2GRAY);
+
+            // Markers are registered once, native side keeps its own copy
+            if (pictureAR == null) {
+                PictureAR ar = new PictureAR();
+                ar.registerMarker(img_0m_th, img_0p_rgba);
+                ar.registerMarker(img_1m_th, img_1p_rgba);
+                pictureAR = ar;
+            }
         } catch (IOException ioe) {
             Log.e(TAG, "Impossible load all required resources", ioe);
         }
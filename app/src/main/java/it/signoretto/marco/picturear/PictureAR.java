@@ -11,11 +11,66 @@ import org.opencv.core.Mat;
 
 public class PictureAR {
 
+    // Pointer to the native state ( markers and pipeline buffers ), 0 after release
+    private long nativeHandle;
+
+    public PictureAR(){
+        nativeHandle = nativeCreate();
+    }
+
+    /**
+     * Register a marker, marker and replacement are copied into native memory once so they can be released after
+     * this call
+     * @param marker_th thresholded marker
+     * @param replacement picture which replaces the marker
+     * @return index of the marker or -1 on error
+     * @throws IllegalStateException if this object has been released
+     */
+    public int registerMarker(Mat marker_th, Mat replacement){
+        checkNotReleased();
+        return nativeRegisterMarker(nativeHandle, marker_th.nativeObj, replacement.nativeObj);
+    }
+
+    /**
+     * Apply AR to the frame with the registered markers
+     * @param frame camera frame, replaced markers are drawn into it
+     * @param debug_info if true additional debug information are computed
+     * @throws IllegalStateException if this object has been released
+     */
+    public void processFrame(Mat frame, boolean debug_info){
+        checkNotReleased();
+        nativeProcessFrame(nativeHandle, frame.nativeObj, debug_info);
+    }
+
+    /**
+     * Release native memory, this object can't be used after this call
+     */
+    public void release(){
+        if(nativeHandle != 0){
+            nativeDestroy(nativeHandle);
+            nativeHandle = 0;
+        }
+    }
+
+    private void checkNotReleased(){
+        if(nativeHandle == 0){
+            throw new IllegalStateException("PictureAR has been released");
+        }
+    }
+
     public static void apply_AR(Mat img_0p, Mat img_1p, Mat img_0m_th, Mat img_1m_th, Mat frame, boolean debug_info){
         applyAR(img_0p.nativeObj, img_1p.nativeObj, img_0m_th.nativeObj, img_1m_th.nativeObj, frame.nativeObj, debug_info);
     }
 
     private static native void applyAR(long img_0p, long img_1p, long img_0m_th, long img_1m_th, long frame, boolean debug_info);
 
+    private static native long nativeCreate();
+
+    private static native int nativeRegisterMarker(long handle, long marker_th, long replacement);
+
+    private static native void nativeProcessFrame(long handle, long frame, boolean debug_info);
+
+    private static native void nativeDestroy(long handle);
+
 
 }
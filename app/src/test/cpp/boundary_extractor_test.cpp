@@ -0,0 +1,176 @@
+//
+// Desktop test of the equivalences claimed by mcv::boundary_extractor: tracing kernels, parallel extraction over bands
+// and length window applied while tracing must give the same boundaries, in the same order, of the reference paths
+//
+
+#include <opencv2/core.hpp>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "boundary_extractor.h"
+
+namespace {
+    int failures = 0;
+
+    // Checked also in release builds, assert would compile out
+    #define CHECK(condition, message) do{ if(!(condition)){ ++failures; std::printf("FAILED %s: %s\n", (message).c_str(), #condition); } }while(0)
+
+    /**
+     * Copy of a boundary which doesn't depend on the extractor ( boundaries from arenas are released by the next call )
+     */
+    struct BoundaryCopy {
+        int length;
+        int min_x, min_y, max_x, max_y;
+        std::vector<cv::Vec2i> points; // decoded with the iterator so both storages are compared the same way
+
+        bool operator==(const BoundaryCopy& other) const {
+            return length == other.length && min_x == other.min_x && min_y == other.min_y && max_x == other.max_x &&
+                   max_y == other.max_y && points == other.points;
+        }
+    };
+
+    std::vector<BoundaryCopy> copyBoundaries(mcv::boundary_extractor& extractor){
+        std::vector<BoundaryCopy> copies;
+        for(const mcv::boundary& b : extractor.get_boundaries()){
+            BoundaryCopy copy{b.length, b.min_x, b.min_y, b.max_x, b.max_y, std::vector<cv::Vec2i>(b.begin(), b.end())};
+            copies.push_back(copy);
+        }
+        return copies;
+    }
+
+    /**
+     * Thresholded images with 1px of BLACK padding, as the pipeline writes them
+     */
+    cv::Mat paddedImage(int rows, int cols){
+        return cv::Mat::zeros(rows+2, cols+2, CV_8UC1);
+    }
+
+    // Isolated pixels and small blobs, many short boundaries
+    cv::Mat noiseImage(std::mt19937& rng, int rows, int cols, int density_percent){
+        cv::Mat image = paddedImage(rows, cols);
+        for(int y = 1; y <= rows; ++y){
+            for(int x = 1; x <= cols; ++x){
+                image.at<uchar>(y, x) = (int)(rng()%100) < density_percent ? mcv::WHITE : mcv::BLACK;
+            }
+        }
+        return image;
+    }
+
+    // Overlapping filled and hollow rectangles, long boundaries which cross many rows
+    cv::Mat rectanglesImage(std::mt19937& rng, int rows, int cols, int count){
+        cv::Mat image = paddedImage(rows, cols);
+        for(int r = 0; r < count; ++r){
+            const int x0 = 1 + (int)(rng()%cols), y0 = 1 + (int)(rng()%rows);
+            const int x1 = std::min(cols, x0 + 2 + (int)(rng()%(cols/2))), y1 = std::min(rows, y0 + 2 + (int)(rng()%(rows/2)));
+            const bool hollow = rng()%2 == 0;
+            const uchar color = rng()%3 == 0 ? mcv::BLACK : mcv::WHITE;
+            for(int y = y0; y <= y1; ++y){
+                for(int x = x0; x <= x1; ++x){
+                    const bool edge = y == y0 || y == y1 || x == x0 || x == x1;
+                    if(!hollow || edge)image.at<uchar>(y, x) = color;
+                }
+            }
+        }
+        return image;
+    }
+
+    // Concentric square rings, boundaries nested into each other
+    cv::Mat ringsImage(int rows, int cols){
+        cv::Mat image = paddedImage(rows, cols);
+        for(int y = 1; y <= rows; ++y){
+            for(int x = 1; x <= cols; ++x){
+                const int ring = std::min(std::min(x-1, y-1), std::min(cols-x, rows-y));
+                image.at<uchar>(y, x) = (ring/2)%2 == 0 ? mcv::WHITE : mcv::BLACK;
+            }
+        }
+        return image;
+    }
+
+    struct Config {
+        mcv::tracing_kernel kernel;
+        mcv::boundary_storage storage;
+        bool arena;
+        int min_length;
+        int max_length;
+    };
+
+    std::string describe(const std::string& image_name, uchar color, const Config& config){
+        char text[160];
+        std::snprintf(text, sizeof(text), "%s color %d kernel %s storage %s arena %d window [%d,%d]", image_name.c_str(), (int)color,
+                      config.kernel == mcv::tracing_kernel::TABLE ? "TABLE" : "SWITCH",
+                      config.storage == mcv::boundary_storage::POINTS ? "POINTS" : "CHAIN_CODE",
+                      (int)config.arena, config.min_length, config.max_length);
+        return text;
+    }
+
+    void configure(mcv::boundary_extractor& extractor, const cv::Mat& image, const Config& config, bool window){
+        extractor.set_padded_image(image);
+        extractor.set_tracing_kernel(config.kernel);
+        extractor.set_boundary_storage(config.storage);
+        extractor.set_arena_allocation(config.arena);
+        extractor.set_length_limits(window ? config.min_length : 0, window ? config.max_length : 0);
+    }
+
+    /**
+     * Reference: SWITCH kernel, POINTS storage, no arena, serial extraction, length window applied by keep_between
+     */
+    std::vector<BoundaryCopy> referenceBoundaries(const cv::Mat& image, uchar color, const Config& config){
+        mcv::boundary_extractor extractor;
+        configure(extractor, image, Config{mcv::tracing_kernel::SWITCH, mcv::boundary_storage::POINTS, false, 0, 0}, false);
+        extractor.find_boundaries(color);
+        if(config.min_length > 0 || config.max_length > 0){
+            extractor.keep_between(config.min_length, config.max_length > 0 ? config.max_length : 1 << 30);
+        }
+        return copyBoundaries(extractor);
+    }
+
+    void testImage(const std::string& image_name, const cv::Mat& image){
+        static const mcv::tracing_kernel KERNELS[] = {mcv::tracing_kernel::SWITCH, mcv::tracing_kernel::TABLE};
+        static const mcv::boundary_storage STORAGES[] = {mcv::boundary_storage::POINTS, mcv::boundary_storage::CHAIN_CODE};
+        static const int WINDOWS[][2] = {{0, 0}, {8, 0}, {0, 40}, {12, 120}};
+        static const uchar COLORS[] = {mcv::BLACK, mcv::WHITE};
+        const int max_bands = std::min(8, image.rows-2);
+
+        for(uchar color : COLORS){
+            for(const int* window : WINDOWS){
+                for(mcv::tracing_kernel kernel : KERNELS){
+                    for(mcv::boundary_storage storage : STORAGES){
+                        for(int arena = 0; arena <= 1; ++arena){
+                            const Config config{kernel, storage, arena == 1, window[0], window[1]};
+                            const std::string name = describe(image_name, color, config);
+                            const std::vector<BoundaryCopy> reference = referenceBoundaries(image, color, config);
+
+                            // Same extractor reused for all calls, as the pipeline does between frames
+                            mcv::boundary_extractor extractor;
+                            configure(extractor, image, config, true);
+                            extractor.find_boundaries(color);
+                            CHECK(copyBoundaries(extractor) == reference, name + " serial");
+
+                            for(int bands = 1; bands <= max_bands; ++bands){
+                                extractor.find_boundaries_parallel(color, bands);
+                                CHECK(copyBoundaries(extractor) == reference, name + " bands " + std::to_string(bands));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    std::mt19937 rng(20170306);
+    testImage("noise 10%", noiseImage(rng, 61, 97, 10));
+    testImage("noise 50%", noiseImage(rng, 64, 64, 50));
+    testImage("rectangles", rectanglesImage(rng, 120, 160, 24));
+    testImage("rings", ringsImage(90, 70));
+    testImage("single row", noiseImage(rng, 1, 40, 50));
+
+    if(failures > 0){
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All boundary extractor checks passed\n");
+    return 0;
+}